@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pagetable.h"
+#include "replay.h"
+#include "arena.h"
+#include "checkpoint.h"
+
+/* Set-dueling between LRU and CLOCK.
+ *
+ * The coremap is split into regions of consecutive frames, and every
+ * virtual page belongs to one region, chosen by hashing its page number.  A
+ * few leader regions always run LRU and a few always run CLOCK, and the
+ * pages sampled into a leader evict only within its frames.  A saturating
+ * counter (psel) goes up on every eviction in an LRU leader and down on
+ * every eviction in a CLOCK leader.  All the other pages share the
+ * follower frames, which run whichever policy is currently faulting less
+ * by a margin, over all of them as one pool.  Free frames are handed out
+ * by group too, so a leader's pages never use another group's frames.
+ *
+ * Each leader and the followers form a group with its own LRU list and
+ * CLOCK hand; both are kept for every frame, so followers can switch at
+ * any time.  A reference and an eviction cost O(1) (amortized for CLOCK).
+ */
+
+extern struct coremap coremap;
+
+#define ADAPT_REGIONS   32      // Regions when memory is large enough
+#define ADAPT_MIN_FRAMES 8      // Smallest region
+#define ADAPT_PSEL_MAX  1023    // 10-bit policy selector
+#define ADAPT_HYST      64      // psel must move this far past the middle
+#define ADAPT_PHASES    32      // Phases listed in the report
+
+enum { POL_LRU, POL_CLOCK };
+static char *pol_names[] = {"lru", "clock"};
+
+static int nregions;
+static int region_frames;       // Frames per region; the last takes the rest
+static int leader_every;        // Every leader_every-th region is a leader
+
+// Group 0 is the followers, then one group per leader region.
+static int ngroups;
+static int *region_group;       // Group of the pages hashed to each region
+static int *group_pol;          // Policy of each leader group
+static unsigned char *frame_group;
+static int *members;            // Frames of each group, group by group
+static int *group_start, *group_len;
+static int *free_hint;          // No free frame in members before this
+
+// LRU: a circular list per group, least recent first, through prev and
+// next; the sentinel of group g is memsize + g.
+static int *lru_prev, *lru_next;
+static unsigned char *ref_bits; // CLOCK: reference bit
+static int *hands;              // CLOCK: hand of each group, into members
+
+static int psel;
+static int winner;
+static long leader_misses[2];
+
+// Follower phases: the reference at which each phase started.
+static int phase_start[ADAPT_PHASES + 1];
+static int phase_pol[ADAPT_PHASES + 1];
+static int nphases;
+static long pol_refs[2];        // References spent under each policy
+static int last_switch;         // ref_count when the current phase began
+
+
+static int is_leader(int r) {
+    return nregions >= 3 && (r % leader_every == 0 ||
+                             r % leader_every == leader_every / 2);
+}
+
+static void switch_to(int pol) {
+    pol_refs[winner] += ref_count - last_switch;
+    last_switch = ref_count;
+    winner = pol;
+    if (nphases <= ADAPT_PHASES) {
+        phase_start[nphases] = ref_count;
+        phase_pol[nphases] = pol;
+    }
+    nphases++;
+}
+
+static int lru_victim(int g) {
+    return lru_next[memsize + g];
+}
+
+static int clock_victim(int g) {
+    int *frames = members + group_start[g];
+
+    // As in clock.c, the hand stays on the victim, so the new page's
+    // reference bit is the next one cleared.
+    for (;;) {
+        int frame = frames[hands[g]];
+
+        if (!ref_bits[frame]) {
+            return frame;
+        }
+        ref_bits[frame] = 0;
+        hands[g] = (hands[g] + 1) % group_len[g];
+    }
+}
+
+
+// Group of the faulting page, from the hash of its page number.
+static int fault_group(void) {
+    unsigned long vpn = fault_vaddr >> page_shift;
+
+    return region_group[(((vpn * 0x9e3779b97f4a7c15UL) >> 32) % nregions)];
+}
+
+/* The lowest free frame of the faulting page's group, or -1 if the group
+ * is full, even if other groups still have free frames.
+ */
+int adaptive_free_frame(pgtbl_entry_t *p) {
+    int g = fault_group();
+    int *frames = members + group_start[g];
+    int i;
+
+    for (i = free_hint[g]; i < group_len[g] && coremap.in_use[frames[i]]; i++) {
+    }
+    free_hint[g] = i;
+    return i < group_len[g] ? frames[i] : -1;
+}
+
+/* Picks the victim from the faulting page's group with that group's
+ * policy, and charges the miss to a leader's policy.
+ */
+int adaptive_evict() {
+    int g = fault_group();
+    int pol = g == 0 ? winner : group_pol[g];
+
+    if (g != 0) {
+        leader_misses[pol]++;
+        if (pol == POL_LRU && psel < ADAPT_PSEL_MAX) {
+            psel++;
+        } else if (pol == POL_CLOCK && psel > 0) {
+            psel--;
+        }
+        // LRU leaders faulting more than CLOCK leaders pushes psel up.
+        // The band around the middle keeps followers from flapping
+        // while the two are about even.
+        if (winner == POL_LRU && psel > ADAPT_PSEL_MAX / 2 + ADAPT_HYST) {
+            switch_to(POL_CLOCK);
+        } else if (winner == POL_CLOCK && psel < ADAPT_PSEL_MAX / 2 - ADAPT_HYST) {
+            switch_to(POL_LRU);
+        }
+    }
+    return pol == POL_LRU ? lru_victim(g) : clock_victim(g);
+}
+
+// Moves frame to the most recent end of its group's LRU list.
+static void lru_touch(int frame) {
+    int s = memsize + frame_group[frame];
+
+    lru_next[lru_prev[frame]] = lru_next[frame];
+    lru_prev[lru_next[frame]] = lru_prev[frame];
+    lru_prev[frame] = lru_prev[s];
+    lru_next[frame] = s;
+    lru_next[lru_prev[s]] = frame;
+    lru_prev[s] = frame;
+}
+
+/* Updates the LRU list and CLOCK reference bit of the referenced frame.
+ */
+void adaptive_ref(pgtbl_entry_t *p) {
+    int frame = p->frame >> PAGE_SHIFT;
+
+    lru_touch(frame);
+    ref_bits[frame] = 1;
+}
+
+/* The page in frame from now lives in frame to.  Within a group to takes
+ * from's place in the LRU list and from goes to the least recent end, as
+ * it is free; across groups, and for a new page (from == -1), to becomes
+ * the most recent.
+ */
+void adaptive_move(int from, int to) {
+    if (from >= 0 && frame_group[from] == frame_group[to]) {
+        int s = memsize + frame_group[from];
+
+        // Unlink to, put it after from, then move from to the head.
+        lru_next[lru_prev[to]] = lru_next[to];
+        lru_prev[lru_next[to]] = lru_prev[to];
+        lru_prev[to] = from;
+        lru_next[to] = lru_next[from];
+        lru_prev[lru_next[from]] = to;
+        lru_next[from] = to;
+        lru_next[lru_prev[from]] = lru_next[from];
+        lru_prev[lru_next[from]] = lru_prev[from];
+        lru_prev[from] = s;
+        lru_next[from] = lru_next[s];
+        lru_prev[lru_next[s]] = from;
+        lru_next[s] = from;
+    } else {
+        lru_touch(to);
+    }
+    ref_bits[to] = from < 0 ? 1 : ref_bits[from];
+
+    // from is free now: members are in frame order, so find it by bisection.
+    if (from >= 0) {
+        int g = frame_group[from];
+        int *frames = members + group_start[g];
+        int lo = 0, hi = group_len[g] - 1;
+
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+
+            if (frames[mid] < from) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo < free_hint[g]) {
+            free_hint[g] = lo;
+        }
+    }
+}
+
+void adaptive_init() {
+    int r, f, g;
+
+    nregions = memsize / ADAPT_MIN_FRAMES;
+    if (nregions > ADAPT_REGIONS) {
+        nregions = ADAPT_REGIONS;
+    } else if (nregions < 1) {
+        nregions = 1;
+    }
+    region_frames = memsize / nregions;
+    leader_every = nregions >= 8 ? 8 : nregions;
+
+    region_group = arena_calloc(&meta_arena, nregions, sizeof(int));
+    group_pol = arena_calloc(&meta_arena, nregions + 1, sizeof(int));
+    ngroups = 1;
+    for (r = 0; r < nregions; r++) {
+        if (is_leader(r)) {
+            group_pol[ngroups] = r % leader_every == 0 ? POL_LRU : POL_CLOCK;
+            region_group[r] = ngroups++;
+        }
+    }
+
+    frame_group = arena_calloc(&meta_arena, memsize, sizeof(unsigned char));
+    members = arena_calloc(&meta_arena, memsize, sizeof(int));
+    group_start = arena_calloc(&meta_arena, ngroups, sizeof(int));
+    group_len = arena_calloc(&meta_arena, ngroups, sizeof(int));
+    lru_prev = arena_calloc(&meta_arena, memsize + ngroups, sizeof(int));
+    lru_next = arena_calloc(&meta_arena, memsize + ngroups, sizeof(int));
+    ref_bits = arena_calloc(&meta_arena, memsize, sizeof(unsigned char));
+    hands = arena_calloc(&meta_arena, ngroups, sizeof(int));
+    free_hint = arena_calloc(&meta_arena, ngroups, sizeof(int));
+
+    for (f = 0; f < memsize; f++) {
+        r = f / region_frames < nregions ? f / region_frames : nregions - 1;
+        frame_group[f] = region_group[r];
+        group_len[frame_group[f]]++;
+    }
+    for (g = 1; g < ngroups; g++) {
+        group_start[g] = group_start[g - 1] + group_len[g - 1];
+    }
+    // Lists and members start in frame order, as each group fills.
+    for (g = 0; g < ngroups; g++) {
+        lru_prev[memsize + g] = lru_next[memsize + g] = memsize + g;
+        group_len[g] = 0;
+    }
+    for (f = 0; f < memsize; f++) {
+        g = frame_group[f];
+        members[group_start[g] + group_len[g]++] = f;
+        lru_prev[f] = lru_next[f] = f;
+        lru_touch(f);
+    }
+
+    psel = ADAPT_PSEL_MAX / 2;
+    winner = POL_LRU;
+    leader_misses[POL_LRU] = leader_misses[POL_CLOCK] = 0;
+    pol_refs[POL_LRU] = pol_refs[POL_CLOCK] = 0;
+    phase_start[0] = 0;
+    phase_pol[0] = POL_LRU;
+    nphases = 1;
+    last_switch = 0;
+}
+
+void adaptive_save(FILE *fp) {
+    ckpt_write(fp, lru_prev, (memsize + ngroups) * sizeof(int));
+    ckpt_write(fp, lru_next, (memsize + ngroups) * sizeof(int));
+    ckpt_write(fp, ref_bits, memsize);
+    ckpt_write(fp, hands, ngroups * sizeof(int));
+    CKPT_WRITE(fp, psel);
+    CKPT_WRITE(fp, winner);
+    CKPT_WRITE(fp, leader_misses);
+    CKPT_WRITE(fp, phase_start);
+    CKPT_WRITE(fp, phase_pol);
+    CKPT_WRITE(fp, nphases);
+    CKPT_WRITE(fp, pol_refs);
+    CKPT_WRITE(fp, last_switch);
+}
+
+// Coming from another algorithm, the first phase starts at the restore point.
+void adaptive_restore(FILE *fp) {
+    if (fp != NULL) {
+        ckpt_read(fp, lru_prev, (memsize + ngroups) * sizeof(int));
+        ckpt_read(fp, lru_next, (memsize + ngroups) * sizeof(int));
+        ckpt_read(fp, ref_bits, memsize);
+        ckpt_read(fp, hands, ngroups * sizeof(int));
+        CKPT_READ(fp, psel);
+        CKPT_READ(fp, winner);
+        CKPT_READ(fp, leader_misses);
+        CKPT_READ(fp, phase_start);
+        CKPT_READ(fp, phase_pol);
+        CKPT_READ(fp, nphases);
+        CKPT_READ(fp, pol_refs);
+        CKPT_READ(fp, last_switch);
+        return;
+    }
+    phase_start[0] = ref_count;
+    last_switch = ref_count;
+}
+
+/* Prints the leaders' misses and the phases the followers went through.
+ */
+void adaptive_report() {
+    int i;
+
+    pol_refs[winner] += ref_count - last_switch;
+    last_switch = ref_count;
+
+    printf("\n");
+    printf("Adaptive regions: %d of %d frames, %d leaders; followers share %d frames\n",
+           nregions, region_frames, ngroups - 1, group_len[0]);
+    printf("Leader evictions: lru %ld, clock %ld\n",
+           leader_misses[POL_LRU], leader_misses[POL_CLOCK]);
+    printf("Follower references: lru %ld, clock %ld\n",
+           pol_refs[POL_LRU], pol_refs[POL_CLOCK]);
+    printf("Policy switches: %d\n", nphases - 1);
+    for (i = 0; i < nphases && i < ADAPT_PHASES; i++) {
+        int end = i + 1 < nphases ? phase_start[i + 1] : ref_count;
+
+        printf("\t[%d - %d): %s\n", phase_start[i], end, pol_names[phase_pol[i]]);
+    }
+    if (nphases > ADAPT_PHASES) {
+        printf("\t... %d more phases\n", nphases - ADAPT_PHASES);
+    }
+}
+
+DEFINE_REPLAY(adaptive)
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pagetable.h"
+#include "arena.h"
+
+#define ARENA_MIN_ALIGN 16
+
+struct arena pgtbl_arena = ARENA_INIT("page tables", 1 << 20);
+struct arena opt_arena = ARENA_INIT("opt records", 1 << 20);
+struct arena meta_arena = ARENA_INIT("metadata", 1 << 18);
+
+// The header sits at the end of its chunk, so the start stays page aligned.
+struct arena_chunk {
+	struct arena_chunk *next;
+	void *base;
+};
+
+static struct arena *arenas;    // Arenas that have allocated a chunk
+
+
+// Adds a chunk with room for at least size bytes to a's list.
+static struct arena_chunk *new_chunk(struct arena *a, size_t size) {
+	struct arena_chunk *c;
+	void *base;
+
+	size = (size + sizeof(*c) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+	if (posix_memalign(&base, PAGE_SIZE, size) != 0) {
+		fprintf(stderr, "Failed to allocate %zu bytes for %s\n", size, a->name);
+		exit(1);
+	}
+	c = (struct arena_chunk *)((char *)base + size - sizeof(*c));
+	c->base = base;
+	c->next = a->chunks;
+	a->chunks = c;
+	if (a->nchunks++ == 0) {
+		a->next_arena = arenas;
+		arenas = a;
+	}
+	a->reserved += size;
+	return c;
+}
+
+/* Returns size bytes from a, aligned to align (a power of 2 no larger than
+ * PAGE_SIZE).  The memory is not cleared.
+ */
+void *arena_alloc(struct arena *a, size_t size, size_t align) {
+	uintptr_t p;
+
+	if (align < ARENA_MIN_ALIGN) {
+		align = ARENA_MIN_ALIGN;
+	}
+	a->allocs++;
+	a->used += size;
+	if (size > a->chunk_size / 4) {
+		// The chunk goes behind the current one, which stays in use.
+		return new_chunk(a, size)->base;
+	}
+	p = ((uintptr_t)a->next + align - 1) & ~(uintptr_t)(align - 1);
+	if (a->next == NULL || p + size > (uintptr_t)a->end) {
+		struct arena_chunk *c = new_chunk(a, a->chunk_size - sizeof(*c));
+
+		p = (uintptr_t)c->base;
+		a->end = (char *)c;
+	}
+	a->next = (char *)(p + size);
+	return (void *)p;
+}
+
+// As arena_alloc() for n objects of size bytes, zero-filled.
+void *arena_calloc(struct arena *a, size_t n, size_t size) {
+	void *p = arena_alloc(a, n * size, ARENA_MIN_ALIGN);
+
+	memset(p, 0, n * size);
+	return p;
+}
+
+// Frees every chunk of a; its allocations must no longer be used.
+void arena_release(struct arena *a) {
+	struct arena_chunk *c = a->chunks;
+
+	while (c != NULL) {
+		struct arena_chunk *next = c->next;
+
+		free(c->base);
+		c = next;
+	}
+	a->chunks = NULL;
+	a->next = a->end = NULL;
+}
+
+void arena_release_all() {
+	struct arena *a;
+
+	for (a = arenas; a != NULL; a = a->next_arena) {
+		arena_release(a);
+	}
+}
+
+/* Prints each arena's allocation count, the bytes handed out and the bytes
+ * reserved in chunks.
+ */
+void arena_report() {
+	struct arena *a;
+
+	printf("\n");
+	for (a = arenas; a != NULL; a = a->next_arena) {
+		printf("Arena %s: %lu allocations, %zu bytes used, %zu bytes in %u chunks (%.1f%% used)\n",
+		       a->name, a->allocs, a->used, a->reserved, a->nchunks,
+		       a->reserved ? (double)a->used / a->reserved * 100 : 0.0);
+	}
+}
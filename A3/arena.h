@@ -0,0 +1,39 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/* Arena allocation for the simulator's long-lived data structures.
+ * An arena hands out memory by bumping a pointer through large chunks, so
+ * the many small allocations of a run (page tables, opt's trace records)
+ * cost no malloc call or header each.  Nothing is freed on its own: an
+ * arena releases all its chunks at once at the end of the run.  Requests
+ * larger than a quarter of a chunk get a chunk to themselves.
+ */
+struct arena_chunk;
+
+struct arena {
+	const char *name;
+	size_t chunk_size;
+	char *next, *end;               // Free space in the current chunk
+	struct arena_chunk *chunks;     // All chunks, newest first
+	struct arena *next_arena;       // Arenas in use, for arena_report()
+	unsigned long allocs;
+	size_t used;                    // Bytes handed out
+	size_t reserved;                // Bytes in chunks
+	unsigned nchunks;
+};
+
+#define ARENA_INIT(name, chunk_size) { (name), (chunk_size) }
+
+extern struct arena pgtbl_arena;        // Second-level page tables
+extern struct arena opt_arena;          // opt's trace records
+extern struct arena meta_arena;         // Coremap and per-frame policy state
+
+extern void *arena_alloc(struct arena *a, size_t size, size_t align);
+extern void *arena_calloc(struct arena *a, size_t n, size_t size);
+extern void arena_release(struct arena *a);
+extern void arena_release_all(void);
+extern void arena_report(void);
+
+#endif // __ARENA_H__
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "cache.h"
+
+int cache_enabled = 0;
+
+enum { CACHE_LRU, CACHE_FIFO, CACHE_RAND };
+
+enum { L1I, L1D, L2, LLC, NLEVELS };
+
+static const char *level_names[NLEVELS] = {"l1i", "l1d", "l2", "llc"};
+static const char *policy_names[] = {"lru", "fifo", "rand"};
+
+/* One level.  A set's ways are consecutive in tag, stamp and dirty; a tag
+ * is the line number + 1, so 0 is an empty way.  The stamp is the time of
+ * the last use (lru) or of the fill (fifo).
+ */
+struct cache {
+	unsigned long size;
+	unsigned ways, line_shift, nsets;
+	int policy;
+	int present;
+
+	addr_t *tag;
+	unsigned long *stamp;
+	unsigned char *dirty;
+	unsigned long clock;
+	unsigned rand_state;
+
+	unsigned long accesses, hits, misses, writebacks;
+	struct cache *next;
+};
+
+static struct cache levels[NLEVELS];
+static struct cache *first_i, *first_d;        // Where references enter
+static unsigned long refs;
+
+
+static int log2_exact(unsigned long v) {
+	int s = 0;
+
+	while ((1UL << s) < v) {
+		s++;
+	}
+	return v != 0 && (1UL << s) == v ? s : -1;
+}
+
+/* Reads "l1d=32K:8:64[:lru],l2=256K:4:64,..." or "default", a typical
+ * desktop hierarchy.  Returns 0, or -1 if the spec is invalid.
+ */
+int cache_parse(char *spec) {
+	char *copy, *tok, *save = NULL;
+	int ret = 0;
+
+	if (strcmp(spec, "default") == 0) {
+		spec = "l1i=32K:8:64,l1d=32K:8:64,l2=256K:4:64,llc=8M:16:64";
+	}
+	copy = strdup(spec);
+	for (tok = strtok_r(copy, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *eq = strchr(tok, '=');
+		char *f[4] = {NULL, NULL, NULL, "lru"}, *end;
+		struct cache *c = NULL;
+		unsigned long line;
+		int i, nf = 0;
+
+		if (eq == NULL) {
+			ret = -1;
+			break;
+		}
+		*eq = '\0';
+		for (i = 0; i < NLEVELS; i++) {
+			if (strcmp(tok, level_names[i]) == 0) {
+				c = &levels[i];
+			}
+		}
+		for (f[0] = strtok_r(eq + 1, ":", &end); f[nf] != NULL && nf < 3; ) {
+			f[++nf] = strtok_r(NULL, ":", &end);
+		}
+		if (c == NULL || nf < 3 || (f[3] != NULL && strtok_r(NULL, ":", &end) != NULL)) {
+			ret = -1;
+			break;
+		}
+		if (f[3] == NULL) {
+			f[3] = "lru";
+		}
+		c->size = strtoul(f[0], &end, 10);
+		if (*end == 'K' || *end == 'k') {
+			c->size <<= 10;
+			end++;
+		} else if (*end == 'M' || *end == 'm') {
+			c->size <<= 20;
+			end++;
+		}
+		c->ways = strtoul(f[1], NULL, 10);
+		line = strtoul(f[2], NULL, 10);
+		c->policy = -1;
+		for (i = 0; i < 3; i++) {
+			if (strcmp(f[3], policy_names[i]) == 0) {
+				c->policy = i;
+			}
+		}
+		// The number of sets must be a power of 2 too.
+		if (*end != '\0' || c->ways == 0 || log2_exact(line) < 0 || c->policy < 0 ||
+		    c->size % (c->ways * line) != 0 ||
+		    log2_exact(c->size / (c->ways * line)) < 0) {
+			ret = -1;
+			break;
+		}
+		c->line_shift = log2_exact(line);
+		c->nsets = c->size / (c->ways * line);
+		c->present = 1;
+	}
+	free(copy);
+	cache_enabled = (ret == 0);
+	return ret;
+}
+
+void cache_init() {
+	struct cache *below = NULL;
+	int i;
+
+	// Misses go to the next level that is present.
+	for (i = NLEVELS - 1; i >= 0; i--) {
+		struct cache *c = &levels[i];
+		unsigned long n = (unsigned long)c->nsets * c->ways;
+
+		if (!c->present) {
+			continue;
+		}
+		c->next = below;
+		if (i >= L2) {
+			below = c;
+		}
+		c->tag = calloc(n, sizeof(addr_t));
+		c->stamp = calloc(n, sizeof(unsigned long));
+		c->dirty = calloc(n, 1);
+		if (c->tag == NULL || c->stamp == NULL || c->dirty == NULL) {
+			perror("Failed to allocate cache");
+			exit(1);
+		}
+		c->rand_state = 2463534242U;
+	}
+	// A missing l1 leaves its references to the first lower level.
+	first_i = levels[L1I].present ? &levels[L1I] : below;
+	first_d = levels[L1D].present ? &levels[L1D] : below;
+}
+
+static unsigned xorshift(unsigned *s) {
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+// One access to the line holding byte addr.
+static void cache_access(struct cache *c, addr_t addr, int write) {
+	addr_t line = addr >> c->line_shift;
+	unsigned long base = (line & (c->nsets - 1)) * c->ways;
+	addr_t *tag = c->tag + base;
+	unsigned long *stamp = c->stamp + base;
+	unsigned w, victim = 0;
+
+	c->accesses++;
+	c->clock++;
+	for (w = 0; w < c->ways; w++) {
+		if (tag[w] == line + 1) {
+			c->hits++;
+			if (c->policy == CACHE_LRU) {
+				stamp[w] = c->clock;
+			}
+			c->dirty[base + w] |= write;
+			return;
+		}
+	}
+
+	c->misses++;
+	if (c->next != NULL) {
+		cache_access(c->next, addr, 0);
+	}
+	for (w = 0; w < c->ways && tag[w] != 0; w++) {
+	}
+	if (w < c->ways) {
+		victim = w;
+	} else if (c->policy == CACHE_RAND) {
+		victim = xorshift(&c->rand_state) % c->ways;
+	} else {
+		for (w = 1; w < c->ways; w++) {
+			if (stamp[w] < stamp[victim]) {
+				victim = w;
+			}
+		}
+	}
+	if (tag[victim] != 0 && c->dirty[base + victim]) {
+		c->writebacks++;
+		if (c->next != NULL) {
+			cache_access(c->next, (tag[victim] - 1) << c->line_shift, 1);
+		}
+	}
+	tag[victim] = line + 1;
+	stamp[victim] = c->clock;
+	c->dirty[base + victim] = write;
+}
+
+/* Runs a batch through the hierarchy, then rounds each address down to its
+ * page for the page-table stage.
+ */
+void cache_batch(struct trace_ref *r, int n) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct cache *c = r[i].type == 'I' ? first_i : first_d;
+		addr_t a = r[i].vaddr;
+		addr_t last = a + (r[i].size ? r[i].size - 1 : 0);
+
+		refs++;
+		if (c != NULL) {
+			// Every line the access touches, in the first level's lines.
+			for (a >>= c->line_shift; a <= last >> c->line_shift; a++) {
+				cache_access(c, a << c->line_shift, r[i].type == 'S' || r[i].type == 'M');
+			}
+		}
+		r[i].vaddr = r[i].vaddr >> page_shift << page_shift;
+	}
+}
+
+void cache_report() {
+	int i;
+
+	printf("\n");
+	printf("Cache references: %lu\n", refs);
+	printf("%-5s %8s %5s %5s %6s %12s %12s %8s %8s %10s\n", "level", "size", "ways",
+	       "line", "policy", "accesses", "misses", "hit %", "MPKI", "writebacks");
+	for (i = 0; i < NLEVELS; i++) {
+		struct cache *c = &levels[i];
+
+		if (!c->present) {
+			continue;
+		}
+		printf("%-5s %7luK %5u %5u %6s %12lu %12lu %8.4f %8.3f %10lu\n",
+		       level_names[i], c->size >> 10, c->ways, 1U << c->line_shift,
+		       policy_names[c->policy], c->accesses, c->misses,
+		       c->accesses ? (double)c->hits / c->accesses * 100 : 0.0,
+		       refs ? (double)c->misses * 1000 / refs : 0.0, c->writebacks);
+	}
+}
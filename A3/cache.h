@@ -0,0 +1,26 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "sim.h"
+
+/* CPU cache hierarchy model (--cache), run on each batch of references
+ * ahead of the page-table stage.  Instruction fetches go to l1i and data
+ * references to l1d; their misses go on to l2 and then llc.  A level left
+ * out of the spec is skipped.  Each level is set-associative, write-back
+ * and write-allocate, with its own size, ways, line size and replacement
+ * policy (lru, fifo or rand), and no inclusion is enforced between levels.
+ *
+ * The model needs byte addresses: a trace reduced to pages, as fastslim
+ * writes them, touches one line per page.  With --lackey the lackey reader
+ * keeps the byte address and size of every reference instead (no Fastslim
+ * reduction).  A reference that crosses a line boundary touches each line.
+ * The addresses are rounded down to their pages for the page-table stage.
+ */
+extern int cache_enabled;
+
+extern int cache_parse(char *spec);
+extern void cache_init(void);
+extern void cache_batch(struct trace_ref *refs, int n);
+extern void cache_report(void);
+
+#endif // __CACHE_H__
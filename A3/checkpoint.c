@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "sim.h"
+#include "cost.h"
+#include "zswap.h"
+#include "tier.h"
+#include "thp.h"
+#include "checkpoint.h"
+
+#define CKPT_BUFSIZE (1 << 20)
+#define CKPT_TRACE_HASHED (1 << 20)     // Bytes of the trace hashed
+
+struct ckpt_header {
+	char magic[8];
+	char alg[16];
+	unsigned memsize;
+	unsigned slow_frames;
+	unsigned page_shift;
+	unsigned simpagesize;
+	int fast_mode;
+	int cost_enabled;
+	int thp_mode;
+	unsigned long zswap_size;
+	unsigned long trace_size;       // 0 if the trace was read from stdin
+	unsigned long trace_hash;       // FNV-1a of its first CKPT_TRACE_HASHED bytes
+};
+
+static const char *ckpt_path;   // For error messages
+
+
+void ckpt_write(FILE *fp, const void *buf, size_t len) {
+	if (fwrite(buf, 1, len, fp) != len) {
+		perror("Failed to write checkpoint");
+		exit(1);
+	}
+}
+
+void ckpt_read(FILE *fp, void *buf, size_t len) {
+	if (fread(buf, 1, len, fp) != len) {
+		fprintf(stderr, "Error: checkpoint %s is truncated\n", ckpt_path);
+		exit(1);
+	}
+}
+
+/* Sets the trace's size and the hash of its start, or zeros for stdin.
+ * They are worked out once per run.
+ */
+static void trace_identity(unsigned long *size, unsigned long *hash) {
+	static unsigned long trace_size, trace_hash;
+	static int known = 0;
+	unsigned char buf[65536];
+	struct stat st;
+	size_t n, i, left = CKPT_TRACE_HASHED;
+	FILE *fp;
+
+	if (!known && tracefile != NULL) {
+		if ((fp = fopen(tracefile, "rb")) == NULL || fstat(fileno(fp), &st) != 0) {
+			perror("Failed to read tracefile for checkpoint");
+			exit(1);
+		}
+		trace_size = st.st_size;
+		trace_hash = 0xcbf29ce484222325UL;
+		while (left > 0 &&
+		       (n = fread(buf, 1, left < sizeof(buf) ? left : sizeof(buf), fp)) > 0) {
+			for (i = 0; i < n; i++) {
+				trace_hash = (trace_hash ^ buf[i]) * 0x100000001b3UL;
+			}
+			left -= n;
+		}
+		fclose(fp);
+	}
+	known = 1;
+	*size = trace_size;
+	*hash = trace_hash;
+}
+
+static void fill_header(struct ckpt_header *h, struct functions *alg) {
+	memset(h, 0, sizeof(*h));
+	strncpy(h->magic, CKPT_MAGIC, sizeof(h->magic));
+	strncpy(h->alg, alg->name, sizeof(h->alg) - 1);
+	h->memsize = memsize;
+	h->slow_frames = slow_frames;
+	h->page_shift = page_shift;
+	h->simpagesize = simpagesize;
+	h->fast_mode = fast_mode;
+	h->cost_enabled = cost_enabled;
+	h->thp_mode = thp_mode;
+	h->zswap_size = zswap_size;
+	trace_identity(&h->trace_size, &h->trace_hash);
+}
+
+/* Writes the simulator state to path, replacing any earlier checkpoint
+ * there only once the new one is complete.
+ */
+void checkpoint_save(const char *path, struct functions *alg) {
+	struct ckpt_header h;
+	char tmp[strlen(path) + 5];
+	FILE *fp;
+
+	ckpt_path = path;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+		perror("Failed to create checkpoint");
+		exit(1);
+	}
+	setvbuf(fp, NULL, _IOFBF, CKPT_BUFSIZE);
+
+	fill_header(&h, alg);
+	CKPT_WRITE(fp, h);
+	pagetable_save(fp);
+	swap_save(fp);
+	if (cost_enabled) {
+		cost_save(fp);
+	}
+	if (zswap_size > 0) {
+		zswap_save(fp);
+	}
+	if (slow_frames > 0) {
+		tier_save(fp);
+	}
+	if (thp_mode != THP_NEVER) {
+		thp_save(fp);
+	}
+	alg->save(fp);
+
+	if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+		perror("Failed to write checkpoint");
+		exit(1);
+	}
+}
+
+/* Loads the state saved in path into a freshly initialised simulator.
+ * The restored ref_count is the number of trace records to skip.
+ */
+void checkpoint_restore(const char *path, struct functions *alg) {
+	struct ckpt_header h, cur;
+	FILE *fp;
+
+	ckpt_path = path;
+	if ((fp = fopen(path, "rb")) == NULL) {
+		perror("Failed to open checkpoint");
+		exit(1);
+	}
+	setvbuf(fp, NULL, _IOFBF, CKPT_BUFSIZE);
+
+	CKPT_READ(fp, h);
+	fill_header(&cur, alg);
+	if (memcmp(h.magic, cur.magic, sizeof(h.magic)) != 0) {
+		fprintf(stderr, "Error: %s is not a checkpoint\n", path);
+		exit(1);
+	}
+	if (h.memsize != cur.memsize || h.slow_frames != cur.slow_frames ||
+	    h.page_shift != cur.page_shift || h.simpagesize != cur.simpagesize ||
+	    h.fast_mode != cur.fast_mode || h.cost_enabled != cur.cost_enabled ||
+	    (h.thp_mode != THP_NEVER) != (cur.thp_mode != THP_NEVER) ||
+	    h.zswap_size != cur.zswap_size) {
+		fprintf(stderr, "Error: checkpoint %s was made with different -m, --slow-frames,\n"
+			"       --page-size, --frame-size, --fast, -c, --thp or --zswap options\n",
+			path);
+		exit(1);
+	}
+	// A trace read from stdin cannot be checked.
+	if (h.trace_size != 0 && cur.trace_size != 0 &&
+	    (h.trace_size != cur.trace_size || h.trace_hash != cur.trace_hash)) {
+		fprintf(stderr, "Error: checkpoint %s was made from a different trace\n", path);
+		exit(1);
+	}
+
+	pagetable_restore(fp);
+	swap_restore(fp);
+	if (cost_enabled) {
+		cost_restore(fp);
+	}
+	if (zswap_size > 0) {
+		zswap_restore(fp);
+	}
+	if (slow_frames > 0) {
+		tier_restore(fp);
+	}
+	if (thp_mode != THP_NEVER) {
+		thp_restore(fp);
+	}
+	if (strcmp(h.alg, cur.alg) == 0) {
+		alg->restore(fp);
+	} else {
+		alg->restore(NULL);
+	}
+	fclose(fp);
+}
@@ -0,0 +1,46 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdio.h>
+#include "sim.h"
+
+/* Checkpoints of the whole simulator state (--checkpoint-every, --restore).
+ *
+ * A checkpoint is one binary file: a header with the run's configuration
+ * and its position in the trace, then a section per module, each made of
+ * a few large writes through a 1 MiB stdio buffer.  It is written to a
+ * temporary name and renamed, so an interrupted run always leaves the
+ * previous checkpoint intact.
+ *
+ * A restore needs the same memory, swap, page and frame sizes, the same
+ * optional modules and the same trace, as far as its size and a hash of its
+ * first MiB tell (a trace on stdin is not checked).  The algorithm may differ, to try several policies
+ * from one warm point: its section is last in the file and is then
+ * skipped, and the new policy's restore hook is called with NULL.
+ */
+#define CKPT_MAGIC "A3CKPT2"
+
+extern void checkpoint_save(const char *path, struct functions *alg);
+extern void checkpoint_restore(const char *path, struct functions *alg);
+
+// Helpers for the modules' save and restore hooks; both exit on error.
+extern void ckpt_write(FILE *fp, const void *buf, size_t len);
+extern void ckpt_read(FILE *fp, void *buf, size_t len);
+#define CKPT_WRITE(fp, var) ckpt_write((fp), &(var), sizeof(var))
+#define CKPT_READ(fp, var) ckpt_read((fp), &(var), sizeof(var))
+
+// Module sections, in file order.
+extern void pagetable_save(FILE *fp);
+extern void pagetable_restore(FILE *fp);
+extern void swap_save(FILE *fp);
+extern void swap_restore(FILE *fp);
+extern void cost_save(FILE *fp);
+extern void cost_restore(FILE *fp);
+extern void zswap_save(FILE *fp);
+extern void zswap_restore(FILE *fp);
+extern void tier_save(FILE *fp);
+extern void tier_restore(FILE *fp);
+extern void thp_save(FILE *fp);
+extern void thp_restore(FILE *fp);
+
+#endif // __CHECKPOINT_H__
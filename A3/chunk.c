@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "tracefmt.h"
+
+/* Parallel chunked simulation of one large trace.
+ *
+ * The trace is split into chunks at line boundaries and each chunk is
+ * simulated by its own process, so every child gets a private copy of the
+ * simulator's global state.  A chunk first replays a warm-up prefix of the
+ * references just before it without counting them, so it does not start
+ * from an empty memory.  The per-chunk counters are then added up.
+ *
+ * The result is an approximation of a serial run.  To estimate how far
+ * off it is, the second half of every warm-up is also simulated, fully
+ * warm, at the end of the preceding chunk.  The difference between the
+ * two miss counts over that stretch shows how much state the cold start
+ * still lacked half-way through warm-up, and the sum over all boundaries
+ * is reported as the error estimate.
+ */
+
+// Byte offsets of a chunk's regions, all at line boundaries.
+struct chunk {
+	long warm;      // [warm, probe): warm-up
+	long probe;     // [probe, start): warm-up, also the end of previous chunk
+	long start;     // [start, tail): counted
+	long tail;      // [tail, end): counted, also the next chunk's probe
+	long end;
+};
+
+struct chunk_result {
+	long hits;
+	long misses;
+	long refs;
+	long evict_clean;
+	long evict_dirty;
+	long head_misses;   // Misses in [probe, start)
+	long tail_misses;   // Misses in [tail, end)
+};
+
+static const char *map;
+static long map_size;
+
+
+// Offset of the first line starting at or after off.
+static long next_line(long off) {
+	const char *nl;
+
+	if (off <= 0 || map[off - 1] == '\n') {
+		return off;
+	}
+	nl = memchr(map + off, '\n', map_size - off);
+	return nl ? nl - map + 1 : map_size;
+}
+
+// Offset of the line n references before the line starting at off.
+// Marker lines do not count as references.
+static long back_records(long off, unsigned long n) {
+	while (n > 0 && off > 0) {
+		off--;
+		while (off > 0 && map[off - 1] != '\n') {
+			off--;
+		}
+		if (map[off] != '=') {
+			n--;
+		}
+	}
+	return off;
+}
+
+// Number of references in the trace.
+static long count_records(void) {
+	const char *p = map, *end = map + map_size, *nl;
+	long n = 0;
+
+	while (p < end) {
+		if (*p != '=' && *p != '\n') {
+			n++;
+		}
+		nl = memchr(p, '\n', end - p);
+		p = nl ? nl + 1 : end;
+	}
+	return n;
+}
+
+static void run_chunk(FILE *fp, struct chunk *c, unsigned swapsize, int fd) {
+	struct chunk_result r;
+	int hits, misses, refs, clean, dirty, m;
+
+	init_sim(swapsize);
+
+	replay_range(fp, c->warm, c->probe);
+	m = miss_count;
+	replay_range(fp, c->probe, c->start);
+	r.head_misses = miss_count - m;
+
+	hits = hit_count;
+	misses = miss_count;
+	refs = ref_count;
+	clean = evict_clean_count;
+	dirty = evict_dirty_count;
+
+	replay_range(fp, c->start, c->tail);
+	m = miss_count;
+	replay_range(fp, c->tail, c->end);
+	r.tail_misses = miss_count - m;
+
+	r.hits = hit_count - hits;
+	r.misses = miss_count - misses;
+	r.refs = ref_count - refs;
+	r.evict_clean = evict_clean_count - clean;
+	r.evict_dirty = evict_dirty_count - dirty;
+
+	swap_destroy();
+	if (write(fd, &r, sizeof(r)) != sizeof(r)) {
+		perror("Failed to send chunk result");
+		_exit(1);
+	}
+	close(fd);
+	_exit(0);
+}
+
+// Kills and reaps the chunks started so far that are still running.
+static void kill_chunks(pid_t *pids, int *fds, int n) {
+	int k;
+
+	for (k = 0; k < n; k++) {
+		if (pids[k] > 0) {
+			kill(pids[k], SIGKILL);
+			waitpid(pids[k], NULL, 0);
+			close(fds[k]);
+		}
+	}
+}
+
+/* Simulates the trace in fp as nchunks chunks in parallel, each warmed up
+ * with the warmup references that precede it, and prints the merged
+ * counters with an error estimate.
+ */
+void run_chunks(FILE *fp, int nchunks, unsigned long warmup, unsigned swapsize) {
+	struct stat st;
+	struct chunk *chunks;
+	struct chunk_result *res, total;
+	pid_t *pids;
+	int *fds;
+	long err = 0, records;
+	int k, next, done, workers;
+
+	if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		fprintf(stderr, "Error: chunked simulation needs a non-empty trace file (-f)\n");
+		exit(1);
+	}
+	map_size = st.st_size;
+	map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (map == MAP_FAILED) {
+		perror("Failed to map tracefile");
+		exit(1);
+	}
+	// Chunks are cut at line boundaries.
+	if (map_size >= TRACE_BIN_MAGIC_LEN &&
+	    memcmp(map, TRACE_BIN_MAGIC, TRACE_BIN_MAGIC_LEN) == 0) {
+		fprintf(stderr, "Error: chunked simulation needs a text trace\n");
+		exit(1);
+	}
+
+	records = count_records();
+	if (nchunks > records) {
+		fprintf(stderr, "Error: --chunks %d is more than the %ld references in the trace\n",
+			nchunks, records);
+		exit(1);
+	}
+
+	chunks = calloc(nchunks, sizeof(struct chunk));
+	res = calloc(nchunks, sizeof(struct chunk_result));
+	pids = calloc(nchunks, sizeof(pid_t));
+	fds = calloc(nchunks, sizeof(int));
+	if (chunks == NULL || res == NULL || pids == NULL || fds == NULL) {
+		perror("Failed to allocate chunk table");
+		exit(1);
+	}
+	for (k = 0; k < nchunks; k++) {
+		chunks[k].start = next_line(map_size / nchunks * k);
+		chunks[k].end = next_line(k + 1 < nchunks ?
+					  map_size / nchunks * (k + 1) : map_size);
+	}
+	for (k = 0; k < nchunks; k++) {
+		struct chunk *c = &chunks[k];
+
+		c->warm = back_records(c->start, warmup);
+		c->probe = back_records(c->start, warmup / 2);
+		c->tail = c->end;
+		if (k + 1 < nchunks) {
+			c->tail = back_records(c->end, warmup / 2);
+			if (c->tail < c->start) {
+				c->tail = c->start;
+			}
+		}
+	}
+
+	// At most one child per online CPU runs at a time.
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers < 1) {
+		workers = 1;
+	}
+	fflush(stdout);
+	for (next = done = 0; done < nchunks; done++) {
+		int status;
+		pid_t pid;
+
+		for (; next < nchunks && next - done < workers; next++) {
+			int pfd[2];
+
+			if (pipe(pfd) != 0 || (pids[next] = fork()) < 0) {
+				perror("Failed to start chunk");
+				kill_chunks(pids, fds, next);
+				exit(1);
+			}
+			if (pids[next] == 0) {
+				close(pfd[0]);
+				run_chunk(fp, &chunks[next], swapsize, pfd[1]);
+			}
+			close(pfd[1]);
+			fds[next] = pfd[0];
+		}
+		// The result fits in the pipe, so a child never blocks on it.
+		pid = waitpid(-1, &status, 0);
+		for (k = 0; k < next && pids[k] != pid; k++) {
+		}
+		if (k == next || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+		    read(fds[k], &res[k], sizeof(struct chunk_result)) !=
+		    sizeof(struct chunk_result)) {
+			fprintf(stderr, "Error: chunk %d failed\n", k);
+			if (k < next) {
+				pids[k] = 0;
+			}
+			kill_chunks(pids, fds, next);
+			exit(1);
+		}
+		close(fds[k]);
+		pids[k] = 0;
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (k = 0; k < nchunks; k++) {
+		long diff = 0;
+
+		if (k > 0) {
+			diff = res[k].head_misses - res[k - 1].tail_misses;
+			diff = diff < 0 ? -diff : diff;
+			err += diff;
+		}
+		printf("Chunk %d: %ld references, %ld misses, boundary error %ld\n",
+		       k, res[k].refs, res[k].misses, diff);
+		total.hits += res[k].hits;
+		total.misses += res[k].misses;
+		total.refs += res[k].refs;
+		total.evict_clean += res[k].evict_clean;
+		total.evict_dirty += res[k].evict_dirty;
+	}
+
+	printf("\n");
+	printf("Hit count: %ld\n", total.hits);
+	printf("Miss count: %ld\n", total.misses);
+	printf("Clean evictions: %ld\n", total.evict_clean);
+	printf("Dirty evictions: %ld\n", total.evict_dirty);
+	printf("Total references : %ld\n", total.refs);
+	printf("Hit rate: %.4f\n", total.refs ? (double)total.hits/total.refs * 100 : 0.0);
+	printf("Miss rate: %.4f\n", total.refs ? (double)total.misses/total.refs * 100 : 0.0);
+	printf("Chunks: %d, warm-up: %lu references\n", nchunks, warmup);
+	printf("Estimated miss count error: +/- %ld (+/- %.4f%% miss rate)\n",
+	       err, total.refs ? (double)err/total.refs * 100 : 0.0);
+
+	munmap((void *)map, map_size);
+	free(chunks);
+	free(res);
+	free(pids);
+	free(fds);
+}
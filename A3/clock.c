@@ -4,16 +4,22 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include "pagetable.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include "arena.h"
 
 
-extern int memsize;
-
 extern int debug;
 
-extern struct frame *coremap;
+extern struct coremap coremap;
 
 static int arm;
 
+// Reference bit of each frame, indexed by frame number.  Kept densely here
+// rather than read from each pte's PG_REF so a sweep of the arm touches
+// contiguous memory instead of chasing coremap.pte[].
+static unsigned char *ref_bits;
+
 
 /* Page to evict is chosen using the clock algorithm.
  * Returns the page frame number (which is also the index in the coremap)
@@ -24,12 +30,12 @@ int clock_evict() {
     while(arm < memsize) {
         
         // The ref bit is 0, replace.
-        if (!(coremap[arm].pte->frame & PG_REF)) {
+        if (!ref_bits[arm]) {
             return arm;
         
             // Used recently, don't replace, but reset the ref bit.
         } else {
-            coremap[arm].pte->frame = coremap[arm].pte->frame & ~PG_REF;
+            ref_bits[arm] = 0;
         }
         
         arm = (arm + 1) % memsize;
@@ -45,8 +51,22 @@ int clock_evict() {
  * Input: The page table entry for the page that is being accessed.
  */
 void clock_ref(pgtbl_entry_t *p) {
-    
-    //return;
+    ref_bits[p->frame >> PAGE_SHIFT] = 1;
+}
+
+/* Batched form of clock_ref(): sets the reference bit of n frames.
+ */
+void clock_ref_batch(unsigned *frames, int n) {
+    for (int i = 0; i < n; i++) {
+        ref_bits[frames[i]] = 1;
+    }
+}
+
+/* The page in frame from now lives in frame to, keeping its reference
+ * bit.  A new page (from == -1) counts as just referenced.
+ */
+void clock_move(int from, int to) {
+    ref_bits[to] = from < 0 ? 1 : ref_bits[from];
 }
 
 /* Initialize any data structures needed for this replacement
@@ -54,4 +74,19 @@ void clock_ref(pgtbl_entry_t *p) {
  */
 void clock_init() {
     arm = 0;
+    ref_bits = arena_calloc(&meta_arena, memsize, sizeof(unsigned char));
+}
+
+void clock_save(FILE *fp) {
+    CKPT_WRITE(fp, arm);
+    ckpt_write(fp, ref_bits, memsize);
 }
+
+void clock_restore(FILE *fp) {
+    if (fp != NULL) {
+        CKPT_READ(fp, arm);
+        ckpt_read(fp, ref_bits, memsize);
+    }
+}
+
+DEFINE_REPLAY_BATCH(clock)
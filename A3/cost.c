@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "cost.h"
+#include "hist.h"
+#include "thp.h"
+#include "arena.h"
+#include "checkpoint.h"
+
+
+int cost_enabled = 0;
+
+// Defaults are rough figures for DRAM behind a 4-level page walk and an
+// NVMe swap device.
+struct cost_params cost = {
+	.hit = 100,
+	.tlb_miss = 30,
+	.zero_fill = 2000,
+	.swap_read = 100000,
+	.swap_write = 100000,
+	.zswap_load = 3000,
+	.zswap_store = 5000,
+	.slow = 250,
+	.migrate = 3000,
+	.huge_fill = 60000,
+	.tlb_entries = 64,
+	.queue_depth = 0,
+};
+
+static addr_t *tlb;              // Tag + 1 of the page cached in each slot
+
+static unsigned long now;        // Simulated time at the start of this ref
+static unsigned long cur_fault;  // Service time of the fault being handled
+static unsigned long dev_busy;   // When the swap device's current op ends
+static unsigned wq;              // Writes waiting behind the current op
+
+static unsigned long refs;
+static unsigned long tlb_misses;
+static unsigned long zero_fills;
+static unsigned long swap_reads;
+static unsigned long swap_writes;
+static unsigned long write_stalls;
+static struct hist fault_hist;
+
+
+/* Parses a comma-separated list of key=value overrides, e.g.
+ * "read=80000,write=120000,queue=16".  The word "default" keeps the
+ * built-in latencies.  Returns 0 on success, -1 on a malformed spec.
+ */
+int cost_parse(char *spec) {
+	char *copy, *tok, *save = NULL;
+	int ret = 0;
+
+	if (strcmp(spec, "default") == 0) {
+		return 0;
+	}
+	copy = strdup(spec);
+	for (tok = strtok_r(copy, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *eq = strchr(tok, '=');
+		char *end;
+		unsigned long v;
+
+		if (eq == NULL) {
+			ret = -1;
+			break;
+		}
+		*eq = '\0';
+		v = strtoul(eq + 1, &end, 10);
+		if (*end != '\0' || end == eq + 1) {
+			ret = -1;
+			break;
+		}
+		if (strcmp(tok, "hit") == 0) {
+			cost.hit = v;
+		} else if (strcmp(tok, "tlb") == 0) {
+			cost.tlb_miss = v;
+		} else if (strcmp(tok, "zero") == 0) {
+			cost.zero_fill = v;
+		} else if (strcmp(tok, "read") == 0) {
+			cost.swap_read = v;
+		} else if (strcmp(tok, "write") == 0) {
+			cost.swap_write = v;
+		} else if (strcmp(tok, "zload") == 0) {
+			cost.zswap_load = v;
+		} else if (strcmp(tok, "zstore") == 0) {
+			cost.zswap_store = v;
+		} else if (strcmp(tok, "slow") == 0) {
+			cost.slow = v;
+		} else if (strcmp(tok, "migrate") == 0) {
+			cost.migrate = v;
+		} else if (strcmp(tok, "hzero") == 0) {
+			cost.huge_fill = v;
+		} else if (strcmp(tok, "tlbsize") == 0 && v > 0 && !(v & (v - 1))) {
+			cost.tlb_entries = v;
+		} else if (strcmp(tok, "queue") == 0) {
+			cost.queue_depth = v;
+		} else {
+			ret = -1;
+			break;
+		}
+	}
+	free(copy);
+	return ret;
+}
+
+void cost_init() {
+	tlb = arena_calloc(&meta_arena, cost.tlb_entries, sizeof(addr_t));
+	hist_reset(&fault_hist);
+	cost_enabled = 1;
+}
+
+// Retire queued writes that the device would have finished by time t.
+static void dev_advance(unsigned long t) {
+	while (wq > 0 && dev_busy <= t) {
+		dev_busy += cost.swap_write;
+		wq--;
+	}
+}
+
+void cost_zero_fill() {
+	zero_fills++;
+	cur_fault += cost.zero_fill;
+}
+
+/* A page-in always blocks the faulting reference.  With a write-back queue,
+ * reads are given priority over queued writes, so the read only waits for
+ * the operation the device is currently busy with.
+ */
+void cost_swap_read() {
+	unsigned long t = now + cur_fault;
+	unsigned long start;
+
+	swap_reads++;
+	if (cost.queue_depth == 0) {
+		cur_fault += cost.swap_read;
+		return;
+	}
+	dev_advance(t);
+	start = dev_busy > t ? dev_busy : t;
+	cur_fault += start - t + cost.swap_read;
+	dev_busy = start + cost.swap_read;
+}
+
+/* Evicting a dirty page is synchronous without a queue.  With a queue the
+ * write is posted, and the fault only stalls if the queue is already full.
+ */
+void cost_swap_write() {
+	unsigned long t = now + cur_fault;
+
+	swap_writes++;
+	if (cost.queue_depth == 0) {
+		cur_fault += cost.swap_write;
+		return;
+	}
+	dev_advance(t);
+	if (dev_busy <= t) {
+		dev_busy = t + cost.swap_write;
+	} else if (wq < cost.queue_depth) {
+		wq++;
+	} else {
+		// Wait for the op in service to finish so the head of the queue
+		// starts and frees a slot for this write.
+		write_stalls++;
+		cur_fault += dev_busy - t;
+		dev_busy += cost.swap_write;
+	}
+}
+
+// Compression runs on the CPU, so it is never queued behind the device.
+void cost_zswap_load() {
+	cur_fault += cost.zswap_load;
+}
+
+void cost_zswap_store() {
+	cur_fault += cost.zswap_store;
+}
+
+// Slow-tier accesses and migrations between tiers are charged to the
+// reference that made them, like a fault's service time.
+void cost_slow_access() {
+	cur_fault += cost.slow;
+}
+
+void cost_migrate() {
+	cur_fault += cost.migrate;
+}
+
+void cost_huge_fill() {
+	cur_fault += cost.huge_fill;
+}
+
+/* Called once per reference after the page table has been updated.
+ * Charges the access, a TLB miss if the translation was not cached, and the
+ * service time accumulated by the fault handler, then advances the clock.
+ */
+void cost_ref(addr_t vaddr, int fault) {
+	addr_t vpn = vaddr >> page_shift;
+	unsigned slot;
+	unsigned long t = cost.hit;
+
+	// A huge page takes one TLB entry for the whole region; its tag has a
+	// high bit set so it cannot match a base page's.
+	if (thp_mode != THP_NEVER && thp_is_huge(vaddr)) {
+		vpn = (vaddr >> HPAGE_SHIFT) | 1UL << 62;
+	}
+	slot = vpn & (cost.tlb_entries - 1);
+
+	// An evicted page always faults before it can be used again, and the
+	// fault refills its slot, so a matching tag is never stale here.
+	if (fault || tlb[slot] != vpn + 1) {
+		tlb_misses++;
+		t += cost.tlb_miss;
+		tlb[slot] = vpn + 1;
+	}
+	if (fault) {
+		hist_add(&fault_hist, cur_fault);
+	}
+	// Pages written back by a shrinking resident set (ws, pff) can add
+	// swap time to a reference that did not fault.
+	t += cur_fault;
+	cur_fault = 0;
+	now += t;
+	refs++;
+}
+
+// Checkpoint section: the clock, device queue, counters and TLB contents.
+void cost_save(FILE *fp) {
+	CKPT_WRITE(fp, now);
+	CKPT_WRITE(fp, cur_fault);
+	CKPT_WRITE(fp, dev_busy);
+	CKPT_WRITE(fp, wq);
+	CKPT_WRITE(fp, refs);
+	CKPT_WRITE(fp, tlb_misses);
+	CKPT_WRITE(fp, zero_fills);
+	CKPT_WRITE(fp, swap_reads);
+	CKPT_WRITE(fp, swap_writes);
+	CKPT_WRITE(fp, write_stalls);
+	CKPT_WRITE(fp, fault_hist);
+	CKPT_WRITE(fp, cost.tlb_entries);
+	ckpt_write(fp, tlb, cost.tlb_entries * sizeof(addr_t));
+}
+
+void cost_restore(FILE *fp) {
+	unsigned tlb_entries;
+
+	CKPT_READ(fp, now);
+	CKPT_READ(fp, cur_fault);
+	CKPT_READ(fp, dev_busy);
+	CKPT_READ(fp, wq);
+	CKPT_READ(fp, refs);
+	CKPT_READ(fp, tlb_misses);
+	CKPT_READ(fp, zero_fills);
+	CKPT_READ(fp, swap_reads);
+	CKPT_READ(fp, swap_writes);
+	CKPT_READ(fp, write_stalls);
+	CKPT_READ(fp, fault_hist);
+	CKPT_READ(fp, tlb_entries);
+	if (tlb_entries != cost.tlb_entries) {
+		fprintf(stderr, "Error: checkpoint was made with tlb=%u\n", tlb_entries);
+		exit(1);
+	}
+	ckpt_read(fp, tlb, cost.tlb_entries * sizeof(addr_t));
+}
+
+void cost_report() {
+	printf("\n");
+	printf("Simulated time: %lu ns\n", now);
+	printf("Effective access time: %.2f ns\n",
+	       refs ? (double)now / refs : 0.0);
+	printf("TLB misses: %lu\n", tlb_misses);
+	printf("Zero-fill faults: %lu\n", zero_fills);
+	printf("Swap reads: %lu\n", swap_reads);
+	printf("Swap writes: %lu\n", swap_writes);
+	if (cost.queue_depth > 0) {
+		printf("Write queue stalls: %lu\n", write_stalls);
+	}
+	printf("Fault service time mean: %.2f ns\n", hist_mean(&fault_hist));
+	printf("Fault service time p50: %lu ns\n",
+	       hist_percentile(&fault_hist, 50.0));
+	printf("Fault service time p99: %lu ns\n",
+	       hist_percentile(&fault_hist, 99.0));
+	printf("Fault service time p99.9: %lu ns\n",
+	       hist_percentile(&fault_hist, 99.9));
+	printf("Fault service time max: %lu ns\n", fault_hist.max);
+}
@@ -0,0 +1,44 @@
+#ifndef __COST_H__
+#define __COST_H__
+
+#include "pagetable.h"
+
+/* Simulated access-cost model.
+ * Every reference is charged a latency (in nanoseconds) depending on whether
+ * it hit in a small direct-mapped TLB, whether it faulted, and how the fault
+ * was serviced (zero-fill or swap read, plus a swap write if the victim was
+ * dirty).  The swap device can optionally queue evictions as asynchronous
+ * writes so that only the page-in sits on the faulting reference's path.
+ */
+struct cost_params {
+	unsigned long hit;        // Access to a resident page (TLB hit)
+	unsigned long tlb_miss;   // Extra cost of a page walk on a TLB miss
+	unsigned long zero_fill;  // Servicing a first-touch (zero-fill) fault
+	unsigned long swap_read;  // Reading a page in from the swap device
+	unsigned long swap_write; // Writing a dirty victim to the swap device
+	unsigned long zswap_load; // Decompressing a page from the zswap pool
+	unsigned long zswap_store;// Compressing a dirty victim into the pool
+	unsigned long slow;       // Extra cost of an access to the slow tier
+	unsigned long migrate;    // Moving a page between memory tiers
+	unsigned long huge_fill;  // Building a huge page (copy and zero-fill)
+	unsigned tlb_entries;     // Number of TLB entries (power of 2)
+	unsigned queue_depth;     // Write-back queue depth, 0 = synchronous
+};
+
+extern int cost_enabled;
+extern struct cost_params cost;
+
+extern int cost_parse(char *spec);
+extern void cost_init(void);
+extern void cost_zero_fill(void);
+extern void cost_swap_read(void);
+extern void cost_swap_write(void);
+extern void cost_zswap_load(void);
+extern void cost_zswap_store(void);
+extern void cost_slow_access(void);
+extern void cost_migrate(void);
+extern void cost_huge_fill(void);
+extern void cost_ref(addr_t vaddr, int fault);
+extern void cost_report(void);
+
+#endif // __COST_H__
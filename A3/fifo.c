@@ -4,15 +4,21 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include "pagetable.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include "arena.h"
 
 
-extern int memsize;
-
 extern int debug;
 
-extern struct frame *coremap;
+extern struct coremap coremap;
 
-static int evict_i;
+// Frames in a circular list from oldest to youngest page, through prev and
+// next, and the frame of the youngest.  Pages only change frames when huge
+// pages are collapsed (fifo_move); otherwise the list stays in frame order
+// and this is a plain round robin over the frames.
+static int *prev, *next;
+static int youngest;
 
 
 /* Page to evict is chosen using the fifo algorithm.
@@ -20,9 +26,9 @@ static int evict_i;
  * for the page that is to be evicted.
  */
 int fifo_evict() {
-    evict_i = (evict_i + 1) % memsize;
+    youngest = next[youngest];
     
-	return evict_i;
+	return youngest;
 }
 
 
@@ -36,10 +42,84 @@ void fifo_ref(pgtbl_entry_t *p) {
 }
 
 
+static void unlink_frame(int f) {
+    next[prev[f]] = next[f];
+    prev[next[f]] = prev[f];
+}
+
+static void insert_after(int at, int f) {
+    prev[f] = at;
+    next[f] = next[at];
+    prev[next[at]] = f;
+    next[at] = f;
+}
+
+/* The page in frame from now lives in frame to, and the two frames swap
+ * places in the list.  A new page (from == -1) is the youngest.
+ */
+void fifo_move(int from, int to) {
+    int pf, pt;
+
+    if (from < 0) {
+        if (to != youngest) {
+            unlink_frame(to);
+            insert_after(youngest, to);
+            youngest = to;
+        }
+        return;
+    }
+    pf = prev[from];
+    pt = prev[to];
+    // With two frames the list is the same either way round.
+    if (memsize > 2) {
+        if (pt == from) {
+            unlink_frame(to);
+            insert_after(pf, to);
+        } else if (pf == to) {
+            unlink_frame(from);
+            insert_after(pt, from);
+        } else {
+            unlink_frame(from);
+            unlink_frame(to);
+            insert_after(pf, to);
+            insert_after(pt, from);
+        }
+    }
+    if (youngest == from) {
+        youngest = to;
+    } else if (youngest == to) {
+        youngest = from;
+    }
+}
+
+
 /* Initialize any data structures needed for this 
  * replacement algorithm 
  */
 void fifo_init() {
-    // evict_i will be between 0 and (memsize - 1) after fifo_evict is called.
-    evict_i = -1;
+    prev = arena_calloc(&meta_arena, memsize, sizeof(int));
+    next = arena_calloc(&meta_arena, memsize, sizeof(int));
+    for (int i = 0; i < memsize; i++) {
+        prev[i] = (i + memsize - 1) % memsize;
+        next[i] = (i + 1) % memsize;
+    }
+    // The first victim is frame 0.
+    youngest = memsize - 1;
+}
+
+void fifo_save(FILE *fp) {
+    CKPT_WRITE(fp, youngest);
+    ckpt_write(fp, next, memsize * sizeof(int));
 }
+
+void fifo_restore(FILE *fp) {
+    if (fp != NULL) {
+        CKPT_READ(fp, youngest);
+        ckpt_read(fp, next, memsize * sizeof(int));
+        for (int i = 0; i < memsize; i++) {
+            prev[next[i]] = i;
+        }
+    }
+}
+
+DEFINE_REPLAY(fifo)
@@ -0,0 +1,67 @@
+#include <string.h>
+#include "hist.h"
+
+
+void hist_reset(struct hist *h) {
+	memset(h, 0, sizeof(struct hist));
+}
+
+static inline unsigned hist_index(unsigned long v) {
+	unsigned msb, shift;
+
+	if (v < HIST_SUB) {
+		return v;
+	}
+	msb = 63 - __builtin_clzl(v);
+	shift = msb - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + ((v >> shift) & (HIST_SUB - 1));
+}
+
+// Middle of the range of values that fall into bucket idx.
+static unsigned long hist_value(unsigned idx) {
+	unsigned shift;
+
+	if (idx < HIST_SUB) {
+		return idx;
+	}
+	shift = idx / HIST_SUB - 1;
+	return ((unsigned long)(HIST_SUB + idx % HIST_SUB) << shift) +
+		((1UL << shift) >> 1);
+}
+
+void hist_add(struct hist *h, unsigned long v) {
+	h->buckets[hist_index(v)]++;
+	h->count++;
+	h->sum += v;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+double hist_mean(struct hist *h) {
+	return h->count ? h->sum / h->count : 0.0;
+}
+
+/* Returns the value at percentile pct (0 < pct <= 100).  The result is the
+ * middle of the bucket holding that rank, clamped to the exact maximum.
+ */
+unsigned long hist_percentile(struct hist *h, double pct) {
+	unsigned long rank, seen = 0;
+	unsigned i;
+
+	if (h->count == 0) {
+		return 0;
+	}
+	rank = (unsigned long)(pct / 100.0 * h->count + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			unsigned long v = hist_value(i);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
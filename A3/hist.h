@@ -0,0 +1,26 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+/* A log-linear histogram for latency-like values.
+ * Values below HIST_SUB are counted exactly; above that, every power of two
+ * is split into HIST_SUB equal buckets, so any reported percentile is within
+ * about 1/HIST_SUB (~3%) of the true value.  The histogram has a fixed size,
+ * so it can absorb billions of samples without growing.
+ */
+#define HIST_SUB_BITS   5
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	unsigned long count;
+	double sum;
+	unsigned long max;
+	unsigned long buckets[HIST_BUCKETS];
+};
+
+extern void hist_reset(struct hist *h);
+extern void hist_add(struct hist *h, unsigned long v);
+extern double hist_mean(struct hist *h);
+extern unsigned long hist_percentile(struct hist *h, double pct);
+
+#endif // __HIST_H__
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "lackey.h"
+
+int lackey_input = 0;
+int lackey_bytes = 0;
+unsigned lackey_slim = 8;
+addr_t marker_start = 0, marker_end = 0;
+
+#define LACKEY_PAGE_SHIFT 12    // The page size fastslim reduces to
+
+/* The Fastslim buffer holds the pages referenced in the current fill, in
+ * first-reference order.  When a new page does not fit, the fill moves to
+ * ready, to be handed out by lackey_drain(), and a new fill begins.  The
+ * set of pages in the fill is an open-addressing table whose slots are all
+ * emptied at once by bumping gen.
+ */
+struct lackey {
+	struct trace_ref *fill;
+	struct trace_ref *ready;
+	unsigned nfill, nready, next_ready;
+
+	addr_t *slot_pg;
+	unsigned *slot_gen;
+	unsigned gen, nslots;
+
+	int in_region;
+	int finished;
+};
+
+// Counts for lackey_report(), from the most recently opened reader.
+static unsigned long lines, records, in_region, regions;
+
+
+/* Reads the MARKER_START and MARKER_END addresses that the traceprogs
+ * programs write, as two %p values.
+ */
+void lackey_read_marker(const char *path) {
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL) {
+		perror("Error opening marker file");
+		exit(1);
+	}
+	if (fscanf(fp, "%lx %lx", &marker_start, &marker_end) != 2 ||
+	    marker_start == 0 || marker_end == 0) {
+		fprintf(stderr, "Error: %s does not hold two marker addresses\n", path);
+		exit(1);
+	}
+	fclose(fp);
+}
+
+struct lackey *lackey_open() {
+	struct lackey *lk = calloc(1, sizeof(struct lackey));
+	unsigned n = lackey_slim ? lackey_slim : 1;
+
+	if (lk == NULL) {
+		perror("Failed to allocate lackey reader");
+		exit(1);
+	}
+	for (lk->nslots = 16; lk->nslots < 2 * n; lk->nslots *= 2) {
+	}
+	lk->fill = malloc(n * sizeof(struct trace_ref));
+	lk->ready = malloc(n * sizeof(struct trace_ref));
+	lk->slot_pg = malloc(lk->nslots * sizeof(addr_t));
+	lk->slot_gen = calloc(lk->nslots, sizeof(unsigned));
+	if (lk->fill == NULL || lk->ready == NULL || lk->slot_pg == NULL ||
+	    lk->slot_gen == NULL) {
+		perror("Failed to allocate lackey reader");
+		exit(1);
+	}
+	lk->gen = 1;
+	lk->in_region = (marker_start == 0);
+	lines = records = in_region = regions = 0;
+	return lk;
+}
+
+void lackey_close(struct lackey *lk) {
+	free(lk->fill);
+	free(lk->ready);
+	free(lk->slot_pg);
+	free(lk->slot_gen);
+	free(lk);
+}
+
+// Moves the fill to ready and starts an empty one.
+static void end_fill(struct lackey *lk) {
+	struct trace_ref *t = lk->ready;
+
+	lk->ready = lk->fill;
+	lk->nready = lk->nfill;
+	lk->next_ready = 0;
+	lk->fill = t;
+	lk->nfill = 0;
+	if (++lk->gen == 0) {
+		memset(lk->slot_gen, 0, lk->nslots * sizeof(unsigned));
+		lk->gen = 1;
+	}
+}
+
+// Slot holding pg, or the empty slot where it would go.
+static unsigned find_slot(struct lackey *lk, addr_t pg) {
+	unsigned i = (pg * 0x9e3779b97f4a7c15UL >> 32) & (lk->nslots - 1);
+
+	while (lk->slot_gen[i] == lk->gen && lk->slot_pg[i] != pg) {
+		i = (i + 1) & (lk->nslots - 1);
+	}
+	return i;
+}
+
+/* Fastslim-Demand: a page already in the fill is dropped.  The caller
+ * drains ready before passing the next line, so it is empty when a fill
+ * ends here.
+ */
+static void slim(struct lackey *lk, char type, addr_t addr, addr_t size) {
+	addr_t pg = addr >> LACKEY_PAGE_SHIFT;
+	unsigned i;
+
+	if (lackey_slim == 0) {
+		lk->ready[0].type = type;
+		lk->ready[0].vaddr = lackey_bytes ? addr : pg << LACKEY_PAGE_SHIFT;
+		lk->ready[0].size = lackey_bytes ? (size < 255 ? size : 255) : 0;
+		lk->nready = 1;
+		lk->next_ready = 0;
+		return;
+	}
+	i = find_slot(lk, pg);
+	if (lk->slot_gen[i] == lk->gen) {
+		return;
+	}
+	if (lk->nfill == lackey_slim) {
+		end_fill(lk);
+		i = find_slot(lk, pg);
+	}
+	lk->slot_gen[i] = lk->gen;
+	lk->slot_pg[i] = pg;
+	lk->fill[lk->nfill].type = type;
+	lk->fill[lk->nfill].vaddr = pg << LACKEY_PAGE_SHIFT;
+	lk->fill[lk->nfill].size = 0;
+	lk->nfill++;
+}
+
+/* Decodes one line, [s, e) without its newline: "I  addr,size" for an
+ * instruction fetch, " L addr,size", " S addr,size" or " M addr,size" for
+ * data, with addr in hex.
+ */
+void lackey_line(struct lackey *lk, const char *s, const char *e) {
+	addr_t addr = 0, size = 0;
+	const char *p = s + 3;
+	char type;
+	int d;
+
+	lines++;
+	if (e - s < 5) {
+		return;
+	}
+	if (s[0] == 'I' && s[1] == ' ' && s[2] == ' ') {
+		type = 'I';
+	} else if (s[0] == ' ' && (s[1] == 'L' || s[1] == 'S' || s[1] == 'M') &&
+		   s[2] == ' ') {
+		type = s[1];
+	} else {
+		return;
+	}
+	for (; p < e && *p != ','; p++) {
+		if (*p >= '0' && *p <= '9') {
+			d = *p - '0';
+		} else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f') {
+			d = (*p | 0x20) - 'a' + 10;
+		} else {
+			return;
+		}
+		addr = (addr << 4) | d;
+	}
+	if (p == s + 3 || p == e) {
+		return;
+	}
+	for (p++; p < e && *p >= '0' && *p <= '9'; p++) {
+		size = size * 10 + (*p - '0');
+	}
+	records++;
+
+	// The marker stores themselves are outside the region.
+	if (marker_start != 0 && type != 'I') {
+		if (!lk->in_region && marker_start - addr < (size ? size : 1)) {
+			lk->in_region = 1;
+			regions++;
+			return;
+		}
+		if (lk->in_region && marker_end - addr < (size ? size : 1)) {
+			lk->in_region = 0;
+			return;
+		}
+	}
+	if (lk->in_region) {
+		in_region++;
+		slim(lk, type, addr, size);
+	}
+}
+
+// At the end of the input: the partial fill becomes ready.
+void lackey_finish(struct lackey *lk) {
+	if (!lk->finished) {
+		lk->finished = 1;
+		end_fill(lk);
+	}
+}
+
+// Hands out up to max ready references; returns how many.
+int lackey_drain(struct lackey *lk, struct trace_ref *refs, int max) {
+	int n = lk->nready - lk->next_ready;
+
+	if (n > max) {
+		n = max;
+	}
+	memcpy(refs, lk->ready + lk->next_ready, n * sizeof(struct trace_ref));
+	lk->next_ready += n;
+	return n;
+}
+
+void lackey_report() {
+	printf("\n");
+	printf("Lackey lines: %lu, references: %lu\n", lines, records);
+	if (marker_start != 0) {
+		printf("Marked regions: %lu, references in them: %lu\n", regions, in_region);
+		if (regions == 0) {
+			fprintf(stderr, "Warning: MARKER_START at 0x%lx was never written\n",
+				marker_start);
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef __LACKEY_H__
+#define __LACKEY_H__
+
+#include "sim.h"
+
+/* Raw valgrind lackey output as a trace (--lackey), so that
+ *
+ *   valgrind --tool=lackey --trace-mem=yes ./prog |& sim --lackey ...
+ *
+ * simulates in the same pass as the program runs, with no log or reduced
+ * trace on disk.  Lines that are not lackey records (valgrind messages,
+ * the program's own output) are skipped.
+ *
+ * With a marker file (--marker, written by the traceprogs programs) only
+ * the references between the stores to MARKER_START and MARKER_END are
+ * kept.  The kept references are reduced to pages and filtered with
+ * Fastslim-Demand over lackey_slim entries, as by traceprogs/fastslim
+ * -k -b lackey_slim, so the same references reach the simulator as through
+ * the file pipeline.  Unlike fastslim, the last partial buffer fill is
+ * replayed too.  lackey_slim 0 keeps every reference, and with lackey_bytes
+ * (set for the cache model) its byte address and size as well.
+ */
+struct lackey;
+
+extern int lackey_input;                // Decode input as lackey output
+extern int lackey_bytes;                // Keep byte addresses and sizes
+extern unsigned lackey_slim;            // Fastslim buffer entries, 0 = off
+extern addr_t marker_start, marker_end; // Region bounds; both 0 = whole trace
+
+extern void lackey_read_marker(const char *path);
+extern struct lackey *lackey_open(void);
+extern void lackey_line(struct lackey *lk, const char *s, const char *e);
+extern void lackey_finish(struct lackey *lk);
+extern int lackey_drain(struct lackey *lk, struct trace_ref *refs, int max);
+extern void lackey_close(struct lackey *lk);
+extern void lackey_report(void);
+
+#endif // __LACKEY_H__
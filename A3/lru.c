@@ -4,13 +4,14 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include "pagetable.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include "arena.h"
 
 
-extern int memsize;
-
 extern int debug;
 
-extern struct frame *coremap;
+extern struct coremap coremap;
 
 // Implement LRU based on the option 1 in the lecture note "L14-PageReplacement."
 // A stack will be too complex to implement and expensive to run.
@@ -58,14 +59,49 @@ void lru_ref(pgtbl_entry_t *p) {
 }
 
 
+/* Batched form of lru_ref(): stamps n references in trace order, keeping
+ * the clock in a register instead of reloading it for every reference.
+ */
+void lru_ref_batch(unsigned *frames, int n) {
+    int t = time;
+
+    for (int i = 0; i < n; i++) {
+        time_stamps[frames[i]] = ++t;
+    }
+    time = t;
+}
+
+
+/* The page in frame from now lives in frame to, keeping its time stamp.
+ * A new page (from == -1) counts as just referenced.
+ */
+void lru_move(int from, int to) {
+    time_stamps[to] = from < 0 ? ++time : time_stamps[from];
+}
+
+
 /* Initialize any data structures needed for this 
  * replacement algorithm 
  */
 void lru_init() {
     time = 0;
     
-    // Question: memory leak?
+    // Freed with the rest of meta_arena at exit.
     // Index of an element = p's frame number, hex to decimal;
     // value of an element = last reference time.
-    time_stamps = calloc(memsize, sizeof(int));
+    time_stamps = arena_calloc(&meta_arena, memsize, sizeof(int));
+}
+
+void lru_save(FILE *fp) {
+    CKPT_WRITE(fp, time);
+    ckpt_write(fp, time_stamps, memsize * sizeof(int));
 }
+
+void lru_restore(FILE *fp) {
+    if (fp != NULL) {
+        CKPT_READ(fp, time);
+        ckpt_read(fp, time_stamps, memsize * sizeof(int));
+    }
+}
+
+DEFINE_REPLAY_BATCH(lru)
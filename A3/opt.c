@@ -4,15 +4,14 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include "pagetable.h"
+#include "replay.h"
+#include "trace.h"
+#include "arena.h"
 
-#define MAX 256
-
-
-extern int memsize;
 
 extern int debug;
 
-extern struct frame *coremap;
+extern struct coremap coremap;
 
 // Path to input trace file.
 extern char * tracefile;
@@ -63,7 +62,7 @@ int opt_evict() {
     // Evict the node with the least "nodes_between", i.e, furthest used in the future.
     for (int i = 0; i < memsize; i++) {
         
-        distance_of_nodes = nodes_between(head_node, (unsigned long)coremap[i].pte);
+        distance_of_nodes = nodes_between(head_node, (unsigned long)coremap.pte[i]);
         
         // Update the furthest period.
         if (distance_of_nodes > temp_max) {
@@ -82,9 +81,8 @@ int opt_evict() {
  */
 // Read the next virtual address in the linked list of the trace file.
 void opt_ref(pgtbl_entry_t *p) {
-    struct lnode* previous = head_node;
+    // The nodes live in opt_arena, which is released as a whole at exit.
     head_node = head_node->next_node;
-    free(previous);
 }
 
 
@@ -95,28 +93,24 @@ void opt_ref(pgtbl_entry_t *p) {
 void opt_init() {
     FILE* fp;
     fp = fopen(tracefile, "r");
-    char type;
     
     if (fp == NULL) {
         fprintf(stderr, "Failed to open the input tracefile\n");
         exit(1);
     }
     
-    char buf[MAX];
-    unsigned long vaddr;
+    // Decode with the same reader as replay_trace(), so with --pipeline
+    // the parsing happens on its own thread here as well.
+    struct trace_reader* tr = trace_open(fp, pipeline ? TRACE_THREADED : 0);
+    struct trace_ref* refs;
+    int n;
     
-    // Get each line of the tracefile
-    while (fgets(buf, MAX, fp) != NULL) {
+    // Get each reference of the tracefile
+    while ((n = trace_next(tr, &refs)) > 0) {
         
-        if (buf[0] != '=') {
-            sscanf(buf, "%c %lx", &type, &vaddr);
-            
-            struct lnode* cur_node = malloc(sizeof(struct lnode));
-            if (cur_node == NULL) {
-                fprintf(stderr, "Failed to macro for current node\n");
-                exit(1);
-            }
-            cur_node->data = vaddr;
+        for (int i = 0; i < n; i++) {
+            struct lnode* cur_node = arena_alloc(&opt_arena, sizeof(struct lnode), 0);
+            cur_node->data = refs[i].vaddr;
             cur_node->next_node = NULL;
         
             if (head_node == NULL) { // First info coming from formatted string.
@@ -130,6 +124,7 @@ void opt_init() {
             }
         }
     }
+    trace_close(tr);
     
     // Finish construct the linked list, close the trace file.
     int p = fclose(fp);
@@ -138,3 +133,18 @@ void opt_init() {
         exit(1);
     }
 }
+
+/* opt's only state is its place in the trace, which follows from ref_count:
+ * nothing is saved, and a restore (under any algorithm) skips that many
+ * records of the list built by opt_init().
+ */
+void opt_save(FILE *fp) {
+}
+
+void opt_restore(FILE *fp) {
+    for (int i = 0; i < ref_count && head_node != NULL; i++) {
+        head_node = head_node->next_node;
+    }
+}
+
+DEFINE_REPLAY(opt)
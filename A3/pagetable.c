@@ -2,11 +2,22 @@
 #include <string.h> 
 #include "sim.h"
 #include "pagetable.h"
+#include "cost.h"
+#include "prof.h"
+#include "zswap.h"
+#include "tier.h"
+#include "thp.h"
+#include "arena.h"
+#include "checkpoint.h"
+#include "replay.h"
 
 
 // The top-level page table (also known as the 'page directory')
 pgdir_entry_t pgdir[PTRS_PER_PGDIR]; 
 
+// Physical memory: memsize fast frames, then any slow-tier frames.
+struct coremap coremap;
+
 // Counters for various events.
 // Your code must increment these when the related events occur.
 int hit_count = 0;
@@ -14,48 +25,46 @@ int miss_count = 0;
 int ref_count = 0;
 int evict_clean_count = 0;
 int evict_dirty_count = 0;
+int resident_count = 0;
+
+// log2 of the simulated page size (--page-size).
+unsigned page_shift = DEFAULT_PAGE_SHIFT;
+
+// Virtual address of the fault being handled, for policies that choose
+// the victim by where the faulting page belongs (adaptive).
+addr_t fault_vaddr;
 
 
 /*
- * Allocates a frame to be used for the virtual page represented by p.
- * If all frames are in use, calls the replacement algorithm's evict_fcn to
- * select a victim frame.  Writes victim to swap if needed, and updates 
- * pagetable entry for victim to indicate that virtual page is no longer in
- * (simulated) physical memory.
- *
- * Counters for evictions should be updated appropriately in this function.
+ * Writes the page held in frame to swap if it is dirty, and updates its
+ * pagetable entry to indicate that it is no longer in (simulated) physical
+ * memory.  Counts the eviction as clean or dirty.
  */
-int allocate_frame(pgtbl_entry_t *p) {
-	int i;
-	int frame = -1;
-	for (i = 0; i < memsize; i++) {
-		if (!coremap[i].in_use) {
-			frame = i;
-			break;
-		}
-	}
-    
-	if (frame == -1) { // Didn't find a free page.
-		// Call replacement algorithm's evict function to select victim.
-		frame = evict_fcn();
-
-		// All frames were in use, so victim frame must hold some page
-		// Write victim page to swap, if needed, and update pagetable.
-		// IMPLEMENTATION NEEDED
+void evict_page(int frame) {
         // A useful youtube video about the steps to evict a page: https://bit.ly/2DqkI8p
         
         // Happen in page table entry (2nd-level).
-        pgtbl_entry_t *victim_pte = coremap[frame].pte;
+        pgtbl_entry_t *victim_pte = coremap.pte[frame];
         
         // Check if the page has been written(M, S), i.e., the dirty bit is on.
         if (victim_pte->frame & PG_DIRTY) {
             evict_dirty_count++;
-            
+
+            // With a compressed tier, the victim goes there instead of to swap.
+            if (zswap_size > 0 && zswap_store(victim_pte, frame)) {
+                return;
+            }
+            if (cost_enabled) {
+                cost_swap_write();
+            }
+
             // Write victim to swap, and update the offset.
+            PROF_START(t_out);
             if ((victim_pte->swap_off = swap_pageout(victim_pte->frame >> PAGE_SHIFT, victim_pte->swap_off))
                 == INVALID_SWAP) {
                 exit(1);
             }
+            PROF_END(PROF_PAGEOUT, t_out);
             
             // Update the status bits to indicate that virtual page is no longer in physical memory.
             // Place parentheses around '&' expressions to silence warnings. Use "~" not "!"; otherwise, it won't work!
@@ -69,16 +78,111 @@ int allocate_frame(pgtbl_entry_t *p) {
             // Do not need turn off the dirty bit, since it is already 0.
             victim_pte->frame = victim_pte->frame & ~PG_VALID;
         }
+}
+
+
+void coremap_init(unsigned nframes) {
+	coremap.in_use = arena_calloc(&meta_arena, nframes, sizeof(char));
+	coremap.tier = arena_calloc(&meta_arena, nframes, sizeof(char));
+	coremap.pte = arena_calloc(&meta_arena, nframes, sizeof(pgtbl_entry_t *));
+	coremap.nfree = memsize;
+	coremap.first_free = 0;
+}
+
+/*
+ * Returns the lowest-numbered free frame in the fast tier, or -1 if all are
+ * in use.  Once memory has filled up this is a counter check, so faults
+ * do not scan the whole coremap.
+ */
+int find_free_frame() {
+	unsigned i;
+
+	if (coremap.nfree == 0) {
+		return -1;
+	}
+	for (i = coremap.first_free; coremap.in_use[i]; i++) {
+	}
+	coremap.first_free = i;
+	return i;
+}
+
+// Marks frame allocated, keeping the free frame count of the fast tier.
+void mark_frame_used(int frame) {
+	if (!coremap.in_use[frame] && coremap.tier[frame] == TIER_FAST) {
+		coremap.nfree--;
+	}
+	coremap.in_use[frame] = 1;
+}
+
+void mark_frame_free(int frame) {
+	if (coremap.in_use[frame] && coremap.tier[frame] == TIER_FAST) {
+		coremap.nfree++;
+		if (frame < coremap.first_free) {
+			coremap.first_free = frame;
+		}
+	}
+	coremap.in_use[frame] = 0;
+}
+
+
+/*
+ * Allocates a frame to be used for the virtual page represented by p.
+ * If all frames are in use, calls the replacement algorithm's evict hook to
+ * select a victim frame.  Writes victim to swap if needed, and updates 
+ * pagetable entry for victim to indicate that virtual page is no longer in
+ * (simulated) physical memory.
+ *
+ * Counters for evictions should be updated appropriately in this function.
+ */
+int allocate_frame(pgtbl_entry_t *p, int (*evict)(void)) {
+	int frame;
+	PROF_START(t_scan);
+	// A partition at its quota, or an adaptive group with no free frame of
+	// its own, evicts one of its pages even if other frames are free.
+	frame = free_frame_fcn != NULL ? free_frame_fcn(p) : find_free_frame();
+	PROF_END(PROF_SCAN, t_scan);
+    
+	if (frame != -1) {
+		resident_count++;
+	} else { // Didn't find a free page.
+		// Call replacement algorithm's evict function to select victim.
+		PROF_START(t_evict);
+		frame = evict();
+		PROF_END(PROF_EVICT, t_evict);
+		if (thp_mode != THP_NEVER) {
+			thp_split_frame(frame);
+		}
+
+		// All frames were in use, so victim frame must hold some page
+		// Write victim page to swap, if needed, and update pagetable.
+		// With a slow tier, the victim is demoted there instead.
+		if (slow_frames > 0) {
+			tier_demote(frame);
+		} else {
+			evict_page(frame);
+		}
 	}
 
 	// Record information for virtual page that will now be stored in frame.
-	coremap[frame].in_use = 1;
-	coremap[frame].pte = p;
+	mark_frame_used(frame);
+	coremap.pte[frame] = p;
 
 	return frame;
 }
 
 
+/*
+ * Evicts the page in frame and returns the frame to the free pool, for
+ * policies whose resident set shrinks as well as grows (ws, pff).
+ */
+void release_frame(int frame) {
+	evict_page(frame);
+	mark_frame_free(frame);
+	coremap.pte[frame] = NULL;
+	resident_count--;
+}
+
+
 /*
  * Initializes the top-level pagetable.
  * This function is called once at the start of the simulation.
@@ -99,7 +203,8 @@ void init_pagetable() {
 }
 
 
-// For simulation, we get second-level pagetables from ordinary memory
+// For simulation, we get second-level pagetables from ordinary memory,
+// carved out of pgtbl_arena
 pgdir_entry_t init_second_level() {
 	int i;
 	pgdir_entry_t new_entry;
@@ -107,14 +212,12 @@ pgdir_entry_t init_second_level() {
 
 	// Allocating aligned memory ensures the low bits in the pointer must
 	// be zero, so we can use them to store our status bits, like PG_VALID
-	if (posix_memalign((void **)&pgtbl, PAGE_SIZE, 
-			   PTRS_PER_PGTBL*sizeof(pgtbl_entry_t)) != 0) {
-		perror("Failed to allocate aligned memory for page table");
-		exit(1);
-	}
+	pgtbl = arena_alloc(&pgtbl_arena,
+			    PTRS_PER_PGTBL(page_shift)*sizeof(pgtbl_entry_t),
+			    PAGE_SIZE);
 
 	// Initialize all entries in second-level pagetable
-	for (i=0; i < PTRS_PER_PGTBL; i++) {
+	for (i=0; i < PTRS_PER_PGTBL(page_shift); i++) {
 		pgtbl[i].frame = 0; // sets all bits, including valid, to zero
 		pgtbl[i].swap_off = INVALID_SWAP;
 	}
@@ -132,95 +235,89 @@ pgdir_entry_t init_second_level() {
  * we fill the frame with zero's to prevent leaking information across
  * pages. 
  * 
- * In our simulation, we also store the the virtual address itself in the 
- * page frame to help with error checking.
+ * In our simulation, we also store the the virtual address of the page
+ * itself in the page frame to help with error checking.
  *
  */
 void init_frame(int frame, addr_t vaddr) {
 	// Calculate pointer to start of frame in (simulated) physical memory
-	char *mem_ptr = &physmem[frame*SIMPAGESIZE];
+	char *mem_ptr = &physmem[(size_t)frame * simpagesize];
 	// Calculate pointer to location in page where we keep the vaddr
         addr_t *vaddr_ptr = (addr_t *)(mem_ptr + sizeof(int));
 	
-	memset(mem_ptr, 0, SIMPAGESIZE); // zero-fill the frame
-	*vaddr_ptr = vaddr;             // record the vaddr for error checking
+	memset(mem_ptr, 0, simpagesize); // zero-fill the frame
+	// record the page's vaddr for error checking
+	*vaddr_ptr = vaddr >> page_shift << page_shift;
 
 	return;
 }
 
 
 /*
- * Locate the physical frame number for the given vaddr using the page table.
+ * Services a page fault on p: allocates a frame (evicting a victim chosen by
+ * evict if memory is full), then either zero-fills it for a first reference
+ * or reads the page back in from swap.
  *
- * If the entry is invalid and not on swap, then this is the first reference 
- * to the page and a (simulated) physical frame should be allocated and 
- * initialized (using init_frame).  
- *
- * If the entry is invalid and on swap, then a (simulated) physical frame
- * should be allocated and filled by reading the page data from swap.
- *
- * Counters for hit, miss and reference events should be incremented in
- * this function.
+ * This is the slow path of find_physpage(); it is kept out of line so the
+ * specialised replay loops in replay.h only inline the hit path.
  */
-char *find_physpage(addr_t vaddr, char type) {
-	pgtbl_entry_t *p = NULL; // Pointer to the full page table entry for vaddr.
-	unsigned idx = PGDIR_INDEX(vaddr); // Get index into page directory (1st-level table).
-    
-	// IMPLEMENTATION NEEDED
-	// Use top-level page directory to get pointer to 2nd-level page table.
-    // Might need to initialize the 2nd-level table.
-    if (!pgdir[idx].pde) {
-        pgdir[idx] = init_second_level();
+void handle_fault(pgtbl_entry_t *p, addr_t vaddr, int (*evict)(void)) {
+    // If p is not in the core map and the core map is full,
+    // then call eviction algorithm to make space for it.
+    fault_vaddr = vaddr;
+
+    // With huge pages enabled, the fault may map the whole 2 MiB region.
+    if (thp_mode != THP_NEVER && thp_fault(p, vaddr)) {
+        return;
     }
-
-	// Use vaddr to get index into the 2nd-level page table, and initialize p.
-    p = &((pgtbl_entry_t *)(pgdir[idx].pde & PAGE_MASK))[PGTBL_INDEX(vaddr)];
-
-	// Check if p is valid or not, on swap or not, and handle appropriately.
-    // p is valid.
-    if (p->frame & PG_VALID) {
-        hit_count++;
+    int allocated_frame = allocate_frame(p, evict);
     
-        // p is invalid.
-    } else {
-        miss_count++;
-        // If p is not in the core map and the core map is full,
-        // then call eviction algorithm to make space for it.
-        int allocated_frame = allocate_frame(p);
-        
-        // p is invalid and not on swap, i.e., this is the first reference to the page
-        // and a physical frame should be allocated and initialized.
-        if (!(p->frame & PG_ONSWAP)) {
+    // p is invalid and not on swap, i.e., this is the first reference to the page
+    // and a physical frame should be allocated and initialized.
+    if (!(p->frame & PG_ONSWAP)) {
+        if (!fast_mode) {
+            PROF_START(t_zero);
             init_frame(allocated_frame, vaddr);
-            
-            // Might need to be written to swap in the future, so turning on the dirty bit.
-            p->frame = ((allocated_frame << PAGE_SHIFT) | PG_ONSWAP) | PG_DIRTY;
-        
-            // p is invalid, but on swap.
-        } else {
-            int err = swap_pagein(allocated_frame, p->swap_off);
-            if (err != 0) {
-                exit(1);
-            }
-            
-            p->frame = (allocated_frame << PAGE_SHIFT) & ~PG_ONSWAP;
+            PROF_END(PROF_ZERO, t_zero);
         }
-    }
-
-	// Make sure that p is marked valid and referenced.
-    p->frame = (p->frame | PG_VALID) | PG_REF;
-    ref_count++;
+        if (cost_enabled) {
+            cost_zero_fill();
+        }
+        
+        // Might need to be written to swap in the future, so turning on the dirty bit.
+        p->frame = ((allocated_frame << PAGE_SHIFT) | PG_ONSWAP) | PG_DIRTY;
     
-    // Also mark it dirty if the access type indicates that the page will be written to.
-    if (type == 'M' || type == 'S') {
-        p->frame = p->frame | PG_DIRTY;
+        // p is invalid, but in the compressed tier.  The tier drops its
+        // copy, so the page must be written out again when evicted.
+    } else if (p->frame & PG_ZSWAP) {
+        zswap_load(p, allocated_frame);
+        p->frame = (allocated_frame << PAGE_SHIFT) | PG_DIRTY;
+
+        // p is invalid, but on swap.
+    } else {
+        PROF_START(t_in);
+        int err = swap_pagein(allocated_frame, p->swap_off);
+        PROF_END(PROF_PAGEIN, t_in);
+        if (err != 0) {
+            exit(1);
+        }
+        if (cost_enabled) {
+            cost_swap_read();
+        }
+        
+        p->frame = (allocated_frame << PAGE_SHIFT) & ~PG_ONSWAP;
     }
+}
 
-	// Call replacement algorithm's ref_fcn for this page
-	ref_fcn(p);
 
-	// Return pointer into (simulated) physical memory at start of frame
-	return &physmem[(p->frame >> PAGE_SHIFT) * SIMPAGESIZE];
+/*
+ * Locate the physical frame number for the given vaddr using the page table,
+ * calling the selected algorithm through ref_fcn and evict_fcn.
+ * See find_physpage_with() in replay.h for the details.
+ */
+char *find_physpage(addr_t vaddr, char type) {
+	return find_physpage_with(vaddr, type, ref_fcn, evict_fcn, page_shift,
+				  simpagesize);
 }
 
 
@@ -229,7 +326,7 @@ void print_pagetbl(pgtbl_entry_t *pgtbl) {
 	int first_invalid, last_invalid;
 	first_invalid = last_invalid = -1;
 
-	for (i=0; i < PTRS_PER_PGTBL; i++) {
+	for (i=0; i < PTRS_PER_PGTBL(page_shift); i++) {
 		if (!(pgtbl[i].frame & PG_VALID) && 
 		    !(pgtbl[i].frame & PG_ONSWAP)) {
 			if (first_invalid == -1) {
@@ -251,7 +348,11 @@ void print_pagetbl(pgtbl_entry_t *pgtbl) {
 				printf("in frame %d\n",pgtbl[i].frame >> PAGE_SHIFT);
 			} else {
 				assert(pgtbl[i].frame & PG_ONSWAP);
-				printf("ONSWAP, at offset %lu\n",pgtbl[i].swap_off);
+				if (pgtbl[i].frame & PG_ZSWAP) {
+					printf("ZSWAP, entry %d\n",pgtbl[i].frame >> PAGE_SHIFT);
+				} else {
+					printf("ONSWAP, at offset %lu\n",pgtbl[i].swap_off);
+				}
 			}			
 		}
 	}
@@ -288,5 +389,101 @@ void print_pagedirectory() {
 	}
 }
 
+/*
+ * Calls fn on every pte of every second-level table, for code that needs
+ * to find the pte behind a frame or pool entry (restoring a checkpoint).
+ */
+void for_each_pte(void (*fn)(pgtbl_entry_t *p)) {
+	int i, j;
+
+	for (i = 0; i < PTRS_PER_PGDIR; i++) {
+		if (pgdir[i].pde & PG_VALID) {
+			pgtbl_entry_t *pgtbl = (pgtbl_entry_t *)(pgdir[i].pde & PAGE_MASK);
+
+			for (j = 0; j < PTRS_PER_PGTBL(page_shift); j++) {
+				fn(&pgtbl[j]);
+			}
+		}
+	}
+}
+
+// Points the coremap back at a resident page's pte.
+static void set_owner(pgtbl_entry_t *p) {
+	if (p->frame & PG_VALID) {
+		coremap.pte[p->frame >> PAGE_SHIFT] = p;
+	}
+}
+
+/*
+ * Checkpoint section for the counters, page tables, coremap and physical
+ * memory.  Each page table is written whole, after its directory index.
+ * The coremap's pte pointers are not saved: they are rebuilt from the
+ * restored tables, since every resident page's pte names its frame.
+ */
+void pagetable_save(FILE *fp) {
+	unsigned nframes = memsize + slow_frames;
+	int i, ntables = 0;
+
+	CKPT_WRITE(fp, hit_count);
+	CKPT_WRITE(fp, miss_count);
+	CKPT_WRITE(fp, ref_count);
+	CKPT_WRITE(fp, evict_clean_count);
+	CKPT_WRITE(fp, evict_dirty_count);
+	CKPT_WRITE(fp, resident_count);
+
+	for (i = 0; i < PTRS_PER_PGDIR; i++) {
+		ntables += (pgdir[i].pde & PG_VALID) != 0;
+	}
+	CKPT_WRITE(fp, ntables);
+	for (i = 0; i < PTRS_PER_PGDIR; i++) {
+		if (pgdir[i].pde & PG_VALID) {
+			CKPT_WRITE(fp, i);
+			ckpt_write(fp, (void *)(pgdir[i].pde & PAGE_MASK),
+				   PTRS_PER_PGTBL(page_shift) * sizeof(pgtbl_entry_t));
+		}
+	}
+
+	ckpt_write(fp, coremap.in_use, nframes);
+	ckpt_write(fp, coremap.tier, nframes);
+	CKPT_WRITE(fp, coremap.nfree);
+	CKPT_WRITE(fp, coremap.first_free);
+	if (!fast_mode) {
+		ckpt_write(fp, physmem, (size_t)nframes * simpagesize);
+	}
+}
+
+void pagetable_restore(FILE *fp) {
+	unsigned nframes = memsize + slow_frames;
+	int i, idx, ntables;
+
+	CKPT_READ(fp, hit_count);
+	CKPT_READ(fp, miss_count);
+	CKPT_READ(fp, ref_count);
+	CKPT_READ(fp, evict_clean_count);
+	CKPT_READ(fp, evict_dirty_count);
+	CKPT_READ(fp, resident_count);
+
+	CKPT_READ(fp, ntables);
+	for (i = 0; i < ntables; i++) {
+		CKPT_READ(fp, idx);
+		if (idx < 0 || idx >= PTRS_PER_PGDIR) {
+			fprintf(stderr, "Error: corrupt page directory in checkpoint\n");
+			exit(1);
+		}
+		pgdir[idx] = init_second_level();
+		ckpt_read(fp, (void *)(pgdir[idx].pde & PAGE_MASK),
+			  PTRS_PER_PGTBL(page_shift) * sizeof(pgtbl_entry_t));
+	}
+
+	ckpt_read(fp, coremap.in_use, nframes);
+	ckpt_read(fp, coremap.tier, nframes);
+	CKPT_READ(fp, coremap.nfree);
+	CKPT_READ(fp, coremap.first_free);
+	if (!fast_mode) {
+		ckpt_read(fp, physmem, (size_t)nframes * simpagesize);
+	}
+	for_each_pte(set_owner);
+}
+
 // Easter egg:
 // "All work(program) and no play makes Jack a dull boy." - The Shining (1980)
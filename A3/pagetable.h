@@ -10,39 +10,50 @@
 #define PAGE_SHIFT      12     // number of bits 2^(PAGE_SHIFT) == PAGE_SIZE
 #define PAGE_SIZE       4096 // Size of pagetable pages
 #define PAGE_MASK       (~(PAGE_SIZE-1))
+// PAGE_SHIFT also fixes the layout of a pte: the frame number is stored
+// above it and the status bits below.  The size of the simulated pages is
+// chosen per run (page_shift), 4 KiB unless --page-size says otherwise.
+// The 32-bit frame field leaves room for MAX_FRAMES frames, both tiers.
+#define MAX_FRAMES      (1U << (32 - PAGE_SHIFT))
+#define DEFAULT_PAGE_SHIFT 12
+#define MAX_PAGE_SHIFT     16
 #define PG_VALID        (0x1) // Valid bit in pgd or pte, set if in memory
 #define PG_DIRTY        (0x2) // Dirty bit in pgd or pte, set if modified
 #define PG_REF          (0x4) // Reference bit, set if page has been referenced
 #define PG_ONSWAP       (0x8) // Set if page has been evicted to swap
+#define PG_ZSWAP        (0x10) // With PG_ONSWAP, page is in the compressed tier
 #define INVALID_SWAP    -1
 
 #ifdef TRACE_64
 // User-level virtual addresses on 64-bit Linux system are 36 bits in our traces
-// and the page size is still 4096 (12 bits). 
+// and the page size is still 4096 (12 bits) by default. 
 // We split the remaining 24 bits evenly into top-level (page directory) index
 // and second-level (page table) index, using 12 bits for each. 
+// With larger pages the page tables shrink, so a table still maps 16 MiB.
 #define PGDIR_SHIFT         24     // Leaves just top 12 bits of vaddr 
 #define PTRS_PER_PGDIR    4096
-#define PTRS_PER_PGTBL    4096
 
 #else // TRACE_32
 // User-level virtual addresses on 32-bit Linux system are 32 bits, and the 
-// page size is still 4096 (12 bits).
+// page size is still 4096 (12 bits) by default.
 // We split the remaining 20 bits evenly into top-level (page directory) index
 // and second level (page table) index, using 10 bits for each.
 #define PGDIR_SHIFT       22     // Leaves just top 10 bits of vaddr 
 #define PTRS_PER_PGDIR  1024
-#define PTRS_PER_PGTBL  1024
 
 #endif
 
-#define PGTBL_MASK        (PTRS_PER_PGTBL-1)
+// The page table index depends on the page size, so it takes the shift.
+// Callers on the hot path pass a constant to let the mask fold.
+#define PTRS_PER_PGTBL(shift) (1U << (PGDIR_SHIFT - (shift)))
 #define PGDIR_INDEX(x)   ((x) >> PGDIR_SHIFT)
-#define PGTBL_INDEX(x)   (((x) >> PAGE_SHIFT) & PGTBL_MASK)
+#define PGTBL_INDEX(x, shift) (((x) >> (shift)) & (PTRS_PER_PGTBL(shift)-1))
 
 
 typedef unsigned long addr_t;
 
+extern unsigned page_shift;     // log2 of the simulated page size
+
 // These defines allow us to take advantage of the compiler's typechecking
 
 // Page directory entry (top-level)
@@ -50,6 +61,11 @@ typedef struct {
 	uintptr_t pde; 
 } pgdir_entry_t;
 
+// The directory entry also stands in for the pmd level: bit 4 + n is set
+// when the table's n-th 2 MiB region is mapped by a huge page (see thp.h).
+// Page tables are page aligned, so these bits are free.
+#define PDE_HUGE(n)     (0x10UL << (n))
+
 // Page table entry (2nd-level). 
 typedef struct { 
 	unsigned int frame; // if valid bit == 1, physical frame holding vpage
@@ -57,34 +73,56 @@ typedef struct {
 } pgtbl_entry_t;    
 
 extern void init_pagetable();
+extern void release_frame(int frame);
+extern void evict_page(int frame);
+extern void init_frame(int frame, addr_t vaddr);
+extern addr_t fault_vaddr;
 extern char *find_physpage(addr_t vaddr, char type);
 
 extern void print_pagedirectory(void);
-
-struct frame {
-	char in_use;       // True if frame is allocated, False if frame is free
-	pgtbl_entry_t *pte;// Pointer back to pagetable entry (pte) for page
-	                   // stored in this frame
-};
+extern void for_each_pte(void (*fn)(pgtbl_entry_t *p));
 
 /* The coremap holds information about physical memory.
- * The index into coremap is the physical page frame number stored
- * in the page table entry (pgtbl_entry_t).
+ * It keeps one dense array per field rather than an array of structs, so
+ * a scan over every frame for one field (in_use, say) reads a byte per
+ * frame instead of a cache line per four frames.  The index into each
+ * array is the physical page frame number stored in the page table entry
+ * (pgtbl_entry_t).
  */
-extern struct frame *coremap;
+struct coremap {
+	char *in_use;        // True if frame is allocated, False if frame is free
+	char *tier;          // TIER_FAST or TIER_SLOW (see tier.h)
+	pgtbl_entry_t **pte; // Pointer back to pagetable entry (pte) for page
+	                     // stored in the frame
+	unsigned nfree;      // Free frames in the fast tier
+	unsigned first_free; // No fast frame below this one is free
+};
+
+extern struct coremap coremap;
+
+extern void coremap_init(unsigned nframes);
+extern int find_free_frame(void);
+extern void mark_frame_used(int frame);
+extern void mark_frame_free(int frame);
 
 
 // Swap functions for use in other files
 extern int swap_init(unsigned swapsize);
 extern void swap_destroy(void);
-extern int swap_pagein(unsigned frame, int swap_offset);
-extern int swap_pageout(unsigned frame, int swap_offset);
+extern int swap_pagein(unsigned frame, off_t swap_offset);
+extern off_t swap_pageout(unsigned frame, off_t swap_offset);
+extern off_t swap_pageout_data(char *frame_ptr, off_t swap_offset);
+extern unsigned swap_used(void);
+extern unsigned long swap_pageins(void);
 
 extern void rand_init();
 extern void lru_init();
 extern void clock_init();
 extern void fifo_init();
 extern void opt_init();
+extern void ws_init();
+extern void pff_init();
+extern void adaptive_init();
 
 // These may not need to do anything for some algorithms
 extern void rand_ref(pgtbl_entry_t *);
@@ -92,11 +130,56 @@ extern void lru_ref(pgtbl_entry_t *);
 extern void clock_ref(pgtbl_entry_t *);
 extern void fifo_ref(pgtbl_entry_t *);
 extern void opt_ref(pgtbl_entry_t *);
+extern void ws_ref(pgtbl_entry_t *);
+extern void pff_ref(pgtbl_entry_t *);
+extern void adaptive_ref(pgtbl_entry_t *);
+
+// Optional batched form of the ref hook: frames[i] is the frame number of
+// the i-th reference.
+extern void lru_ref_batch(unsigned *frames, int n);
+extern void clock_ref_batch(unsigned *frames, int n);
 
 extern int rand_evict();
 extern int lru_evict();
 extern int clock_evict();
 extern int fifo_evict();
 extern int opt_evict();
+extern int ws_evict();
+extern int pff_evict();
+extern int adaptive_evict();
+
+// Policy-specific statistics printed at exit, for algorithms that have any.
+extern void ws_report();
+extern void pff_report();
+extern void adaptive_report();
+
+// Checkpoint hooks (see checkpoint.h).  restore is passed NULL when the
+// checkpoint was made with another algorithm, and starts the policy from
+// the restored memory instead.
+extern void rand_save(FILE *fp);
+extern void lru_save(FILE *fp);
+extern void clock_save(FILE *fp);
+extern void fifo_save(FILE *fp);
+extern void opt_save(FILE *fp);
+extern void ws_save(FILE *fp);
+extern void pff_save(FILE *fp);
+extern void adaptive_save(FILE *fp);
+extern void rand_restore(FILE *fp);
+extern void lru_restore(FILE *fp);
+extern void clock_restore(FILE *fp);
+extern void fifo_restore(FILE *fp);
+extern void opt_restore(FILE *fp);
+extern void ws_restore(FILE *fp);
+extern void pff_restore(FILE *fp);
+extern void adaptive_restore(FILE *fp);
+
+// Frame move hooks, for policies with per-frame state (see struct functions).
+extern void lru_move(int from, int to);
+extern void clock_move(int from, int to);
+extern void fifo_move(int from, int to);
+extern void adaptive_move(int from, int to);
+
+// Free frame hook (see struct functions).
+extern int adaptive_free_frame(pgtbl_entry_t *p);
 
 #endif /* PAGETABLE_H */
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "arena.h"
+#include "part.h"
+
+/* The policies each keep their state for every frame in one instance, so
+ * the partitions carry their own: the frames' reference times and bits
+ * are shared (a frame is in one partition at a time), the fifo queue, the
+ * clock arm and the ghosts are per partition.
+ */
+enum { POL_RAND, POL_LRU, POL_FIFO, POL_CLOCK, NPOLICIES };
+
+static const char *policy_names[NPOLICIES] = {"rand", "lru", "fifo", "clock"};
+static const char *part_names[NPARTS] = {"Code", "Data"};
+
+struct part {
+	int policy;
+	unsigned quota, used;
+
+	unsigned *queue;        // fifo: the partition's frames in fill order
+	unsigned head;
+	unsigned arm;           // clock
+
+	pgtbl_entry_t **ghosts; // Ring of the last pages evicted
+	unsigned next_ghost;
+
+	unsigned long refs, hits, misses, ghost_hits;
+	unsigned long period_hits, period_ghost_hits;
+	unsigned period_depth;  // Deepest ghost hit in the period, plus one
+};
+
+static struct part parts[NPARTS];
+static char *owner;             // Partition of each frame in use
+static unsigned *stamp;         // Time of each frame's last reference
+static unsigned char *ref_bits;
+static unsigned now;
+static int cur;                 // Partition of the reference being replayed
+
+static long code_frames = -1;   // From the spec; -1 = half of memory
+static int dynamic = 0;
+static unsigned long period = 4096, period_left;
+static unsigned nghosts;
+static unsigned long moves;
+static unsigned quota_min, quota_max;
+
+
+static int policy_of(char *name) {
+	int i;
+
+	for (i = 0; i < NPOLICIES; i++) {
+		if (strcmp(name, policy_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Reads "code=N|dynamic[:N],code-alg=A,data-alg=A,period=N", any of them
+ * left out.  The code partition gets half of memory by default, and the
+ * partitions use default_alg (-a) unless given their own.  Returns 0, or -1
+ * if the spec is invalid.
+ */
+int part_parse(char *spec, char *default_alg) {
+	char *copy = strdup(spec), *tok, *save = NULL;
+	int ret = 0;
+
+	parts[PART_CODE].policy = parts[PART_DATA].policy = policy_of(default_alg);
+	for (tok = strtok_r(copy, ",", &save); tok != NULL && ret == 0;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *eq = strchr(tok, '='), *end;
+
+		if (eq == NULL) {
+			ret = -1;
+			break;
+		}
+		*eq++ = '\0';
+		if (strcmp(tok, "code") == 0) {
+			if (strncmp(eq, "dynamic", 7) == 0) {
+				dynamic = 1;
+				eq += 7;
+				if (*eq == '\0') {
+					continue;
+				} else if (*eq++ != ':') {
+					ret = -1;
+					break;
+				}
+			}
+			code_frames = strtol(eq, &end, 10);
+			ret = (*end != '\0' || end == eq || code_frames < 1) ? -1 : 0;
+		} else if (strcmp(tok, "code-alg") == 0) {
+			ret = (parts[PART_CODE].policy = policy_of(eq)) < 0 ? -1 : 0;
+		} else if (strcmp(tok, "data-alg") == 0) {
+			ret = (parts[PART_DATA].policy = policy_of(eq)) < 0 ? -1 : 0;
+		} else if (strcmp(tok, "period") == 0) {
+			period = strtoul(eq, &end, 10);
+			ret = (*end != '\0' || period == 0) ? -1 : 0;
+		} else {
+			ret = -1;
+		}
+	}
+	free(copy);
+	if (parts[PART_CODE].policy < 0 || parts[PART_DATA].policy < 0) {
+		ret = -1;
+	}
+	return ret;
+}
+
+// The init_fcn: runs after the coremap is set up.
+void part_init() {
+	int i;
+
+	if (code_frames < 0) {
+		code_frames = memsize / 2;
+	}
+	if (memsize < 2 || code_frames >= memsize) {
+		fprintf(stderr, "Error: --partition needs at least one frame for data "
+			"(code=%ld, -m %u)\n", code_frames, memsize);
+		exit(1);
+	}
+	parts[PART_CODE].quota = code_frames;
+	parts[PART_DATA].quota = memsize - code_frames;
+	quota_min = quota_max = code_frames;
+	nghosts = memsize / 32 > 0 ? memsize / 32 : 1;
+	period_left = period;
+
+	owner = arena_calloc(&meta_arena, memsize, sizeof(char));
+	stamp = arena_calloc(&meta_arena, memsize, sizeof(unsigned));
+	ref_bits = arena_calloc(&meta_arena, memsize, sizeof(unsigned char));
+	for (i = 0; i < NPARTS; i++) {
+		parts[i].queue = arena_calloc(&meta_arena, memsize, sizeof(unsigned));
+		parts[i].ghosts = arena_calloc(&meta_arena, nghosts, sizeof(pgtbl_entry_t *));
+	}
+}
+
+void part_ref(pgtbl_entry_t *p) {
+	unsigned frame = p->frame >> PAGE_SHIFT;
+
+	stamp[frame] = ++now;
+	ref_bits[frame] = 1;
+}
+
+// Gives frame to the partition of the current reference.
+static void take(unsigned frame) {
+	struct part *pt = &parts[cur];
+
+	owner[frame] = cur;
+	pt->queue[(pt->head + pt->used) % memsize] = frame;
+	pt->used++;
+}
+
+/* A free frame for p, which is faulting, if its partition is under quota,
+ * or -1.  Every fault comes through here, so ghost hits are counted here.
+ */
+int part_free_frame(pgtbl_entry_t *p) {
+	struct part *pt = &parts[cur];
+	unsigned i;
+	int frame;
+
+	if (dynamic) {
+		for (i = 0; i < nghosts; i++) {
+			if (pt->ghosts[i] == p) {
+				unsigned depth = (pt->next_ghost + nghosts - i - 1) % nghosts + 1;
+
+				pt->ghosts[i] = NULL;
+				pt->ghost_hits++;
+				pt->period_ghost_hits++;
+				if (depth > pt->period_depth) {
+					pt->period_depth = depth;
+				}
+				break;
+			}
+		}
+	}
+	if (pt->used >= pt->quota || (frame = find_free_frame()) < 0) {
+		return -1;
+	}
+	take(frame);
+	return frame;
+}
+
+// The frame that partition from's policy evicts.
+static unsigned victim(int from) {
+	struct part *pt = &parts[from];
+	unsigned f, best = 0;
+	int found = 0;
+
+	switch (pt->policy) {
+	case POL_RAND:
+		do {
+			f = random() % memsize;
+		} while (owner[f] != from || !coremap.in_use[f]);
+		return f;
+	case POL_LRU:
+		for (f = 0; f < memsize; f++) {
+			if (owner[f] == from && coremap.in_use[f] && (!found || stamp[f] < stamp[best])) {
+				best = f;
+				found = 1;
+			}
+		}
+		return best;
+	case POL_CLOCK:
+		for (;;) {
+			f = pt->arm;
+			pt->arm = (pt->arm + 1) % memsize;
+			if (owner[f] == from && coremap.in_use[f]) {
+				if (!ref_bits[f]) {
+					return f;
+				}
+				ref_bits[f] = 0;
+			}
+		}
+	default:
+		return pt->queue[pt->head];
+	}
+}
+
+/* The evict_fcn.  A partition under quota when memory is full takes a frame
+ * from the other one, which is over its quota.
+ */
+int part_evict() {
+	int from = parts[cur].used < parts[cur].quota ? !cur : cur;
+	struct part *pt = &parts[from];
+	unsigned frame = victim(from), i;
+
+	// Keep the fifo queue in order without the frame: fifo's victim is
+	// the front, while the others may take one from the middle.
+	if (pt->policy == POL_FIFO) {
+		pt->head = (pt->head + 1) % memsize;
+	} else {
+		for (i = 0; pt->queue[(pt->head + i) % memsize] != frame; i++) {
+		}
+		for (; i + 1 < pt->used; i++) {
+			pt->queue[(pt->head + i) % memsize] = pt->queue[(pt->head + i + 1) % memsize];
+		}
+	}
+	pt->used--;
+
+	pt->ghosts[pt->next_ghost] = coremap.pte[frame];
+	pt->next_ghost = (pt->next_ghost + 1) % nghosts;
+	take(frame);
+	return frame;
+}
+
+/* Whether partition to should take period_depth frames from the other:
+ * its ghost hits per frame taken must beat, by a quarter, the hits per
+ * frame in use that the other had this period.
+ */
+static int should_grow(int to) {
+	struct part *pt = &parts[to], *other = &parts[!to];
+	unsigned used = other->used > 0 ? other->used : 1;
+
+	return pt->period_ghost_hits > 0 &&
+	       (double)pt->period_ghost_hits / pt->period_depth >
+	       1.25 * other->period_hits / used;
+}
+
+/* Moves the code quota: idle frames go to a partition at its quota that
+ * is missing its ghosts, and otherwise the one whose ghost hits say it
+ * needs frames more grows.
+ */
+static void rebalance(void) {
+	struct part *code = &parts[PART_CODE], *data = &parts[PART_DATA];
+	unsigned q = code->quota;
+
+	if (code->used < code->quota && data->used >= data->quota &&
+	    data->period_ghost_hits > 0) {
+		q = code->used > 0 ? code->used : 1;
+	} else if (data->used < data->quota && code->used >= code->quota &&
+		   code->period_ghost_hits > 0) {
+		q = memsize - (data->used > 0 ? data->used : 1);
+	} else if (should_grow(PART_CODE)) {
+		q = q + code->period_depth < memsize ? q + code->period_depth : memsize - 1;
+	} else if (should_grow(PART_DATA)) {
+		q = q > data->period_depth ? q - data->period_depth : 1;
+	}
+	if (q != code->quota) {
+		moves++;
+		code->quota = q;
+		data->quota = memsize - q;
+		quota_min = q < quota_min ? q : quota_min;
+		quota_max = q > quota_max ? q : quota_max;
+	}
+	code->period_hits = data->period_hits = 0;
+	code->period_ghost_hits = data->period_ghost_hits = 0;
+	code->period_depth = data->period_depth = 0;
+	period_left = period;
+}
+
+/* The replay_fcn: the generic path, with each reference's partition set
+ * for the fault handler and its hit or miss counted.
+ */
+void part_replay(struct trace_ref *refs, int n) {
+	int i, misses;
+
+	for (i = 0; i < n; i++) {
+		cur = refs[i].type == 'I' ? PART_CODE : PART_DATA;
+		misses = miss_count;
+		access_mem(refs[i].type, refs[i].vaddr);
+		parts[cur].refs++;
+		if (miss_count != misses) {
+			parts[cur].misses++;
+		} else {
+			parts[cur].hits++;
+			parts[cur].period_hits++;
+		}
+		if (dynamic && --period_left == 0) {
+			rebalance();
+		}
+	}
+}
+
+void part_report() {
+	int i;
+
+	printf("\n");
+	for (i = 0; i < NPARTS; i++) {
+		struct part *pt = &parts[i];
+
+		printf("%s partition: %s, %s %u frames, %lu refs, %lu hits, %lu misses, hit rate %.4f\n",
+		       part_names[i], policy_names[pt->policy], dynamic ? "final quota" : "quota",
+		       pt->quota, pt->refs, pt->hits,
+		       pt->misses, pt->refs ? (double)pt->hits / pt->refs * 100 : 0.0);
+	}
+	if (dynamic) {
+		printf("Code quota: %u-%u frames, %lu moves, ghost hits: code %lu, data %lu\n",
+		       quota_min, quota_max, moves, parts[PART_CODE].ghost_hits,
+		       parts[PART_DATA].ghost_hits);
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef __PART_H__
+#define __PART_H__
+
+#include "sim.h"
+#include "pagetable.h"
+
+/* Code/data partitioned memory (--partition).  Every frame belongs to the
+ * code partition, which holds the pages first faulted in by an instruction
+ * fetch, or to the data partition, and each partition has a quota of
+ * frames and its own replacement policy (rand, lru, fifo or clock).  A
+ * fault takes a free frame if its partition is under quota, and otherwise
+ * evicts one of its partition's pages, so a data scan cannot push code out.
+ *
+ * With dynamic quotas, each partition remembers the last memsize/32 pages
+ * it evicted (its ghosts).  A fault on a ghost is a miss that a few more
+ * frames would have saved: as many as the ghost's depth in the list.  Every
+ * period references, frames a partition leaves idle go to the other one if
+ * it is at its quota.  Otherwise a partition grows by the depth of its
+ * deepest ghost hit if its ghost hits per frame of that growth beat the
+ * other's hits per frame in use by a margin, since those are what the
+ * other stands to lose.  A partition over its quota gives up frames as the
+ * other one faults.
+ */
+enum { PART_CODE, PART_DATA, NPARTS };
+
+extern int part_parse(char *spec, char *default_alg);
+extern void part_init(void);
+extern void part_ref(pgtbl_entry_t *p);
+extern int part_free_frame(pgtbl_entry_t *p);
+extern int part_evict(void);
+extern void part_replay(struct trace_ref *refs, int n);
+extern void part_report(void);
+
+#endif // __PART_H__
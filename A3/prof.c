@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <time.h>
+#include "prof.h"
+
+#ifdef PROFILE
+
+struct hist prof_hist[PROF_PHASES];
+unsigned prof_tick = 0;
+
+static char *prof_names[PROF_PHASES] = {
+	"walk", "scan", "evict", "pageout", "pagein", "zero"
+};
+
+
+#if !defined(__x86_64__) && !defined(__i386__)
+unsigned long prof_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+#endif
+
+void prof_init() {
+	int i;
+
+	for (i = 0; i < PROF_PHASES; i++) {
+		hist_reset(&prof_hist[i]);
+	}
+	prof_tick = 0;
+}
+
+/* Prints count, mean, p50, p99 and max for every phase.  The counts are
+ * cumulative, so a series of snapshots can be differenced.
+ */
+void prof_report(FILE *fp, char *title) {
+	int i;
+
+	fprintf(fp, "\n%s (%s; walk sampled 1/%d):\n", title, PROF_UNIT,
+		PROF_WALK_SAMPLE);
+	fprintf(fp, "%-8s %12s %12s %10s %10s %12s\n",
+		"phase", "count", "mean", "p50", "p99", "max");
+	for (i = 0; i < PROF_PHASES; i++) {
+		struct hist *h = &prof_hist[i];
+
+		fprintf(fp, "%-8s %12lu %12.1f %10lu %10lu %12lu\n",
+			prof_names[i], h->count, hist_mean(h),
+			hist_percentile(h, 50.0), hist_percentile(h, 99.0),
+			h->max);
+	}
+}
+
+#endif // PROFILE
@@ -0,0 +1,73 @@
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include <stdio.h>
+
+/* Hot-path instrumentation.
+ * Each phase of page handling is timed with the TSC (clock_gettime on
+ * other architectures) into a log-linear histogram.  The page walk runs on
+ * every reference and is only a few nanoseconds long, so just one walk in
+ * PROF_WALK_SAMPLE is timed; the fault phases are timed every time.
+ *
+ * Compiled in only when PROFILE is defined (make PROFILE=1).  Otherwise
+ * every PROF_ macro expands to nothing and the replay loops are unchanged.
+ */
+enum prof_phase {
+	PROF_WALK,      // Page-table lookup in lookup_pte()
+	PROF_SCAN,      // Free-frame search in allocate_frame()
+	PROF_EVICT,     // The algorithm's evict hook
+	PROF_PAGEOUT,   // swap_pageout() of a dirty victim
+	PROF_PAGEIN,    // swap_pagein()
+	PROF_ZERO,      // init_frame() of a first-touch page
+	PROF_PHASES
+};
+
+#define PROF_WALK_SAMPLE 64     // Power of 2
+
+#ifdef PROFILE
+
+#include "hist.h"
+
+#define PROF_ENABLED 1
+
+extern struct hist prof_hist[PROF_PHASES];
+extern unsigned prof_tick;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROF_UNIT "cycles"
+static inline unsigned long prof_now(void) {
+	return __rdtsc();
+}
+#else
+#define PROF_UNIT "ns"
+extern unsigned long prof_now(void);     // clock_gettime(), in prof.c
+#endif
+
+#define PROF_START(t)           unsigned long t = prof_now()
+#define PROF_END(phase, t)      hist_add(&prof_hist[phase], prof_now() - (t))
+
+// Like PROF_START/PROF_END, but only for one call in PROF_WALK_SAMPLE.
+#define PROF_SAMPLE_START(t)						\
+	unsigned long t = (++prof_tick & (PROF_WALK_SAMPLE - 1)) ? 0 : prof_now()
+#define PROF_SAMPLE_END(phase, t)					\
+	do { if (t) { PROF_END(phase, t); } } while (0)
+
+extern void prof_init(void);
+extern void prof_report(FILE *fp, char *title);
+
+#else
+
+#define PROF_ENABLED 0
+
+#define PROF_START(t)
+#define PROF_END(phase, t)
+#define PROF_SAMPLE_START(t)
+#define PROF_SAMPLE_END(phase, t)
+
+static inline void prof_init(void) {}
+static inline void prof_report(FILE *fp, char *title) {}
+
+#endif // PROFILE
+
+#endif // __PROF_H__
@@ -5,9 +5,13 @@
 #include <stdlib.h>
 #include "sim.h"
 #include "pagetable.h"
+#include "replay.h"
+#include "checkpoint.h"
 
 
-extern struct frame *coremap;
+extern struct coremap coremap;
+
+static unsigned long draws;     // Calls to random(), to replay on restore
 
 /* Page to evict is chosen using the rand algorithm.
  * Returns the page frame number (which is also the index in the coremap)
@@ -16,6 +20,8 @@ extern struct frame *coremap;
 int rand_evict() {
 	// choose index in coremap to evict a page from
 	int idx = (int)(random() % memsize);
+
+	draws++;
 	
 	return idx;
 }
@@ -30,4 +36,26 @@ void rand_ref(pgtbl_entry_t *p) {
 }
 
 void rand_init() {
+	draws = 0;
+}
+
+/* random() has no portable way to save its state, so a checkpoint records
+ * how many numbers were drawn and a restore draws them again.
+ */
+void rand_save(FILE *fp) {
+	CKPT_WRITE(fp, draws);
 }
+
+void rand_restore(FILE *fp) {
+	unsigned long n;
+
+	if (fp != NULL) {
+		CKPT_READ(fp, n);
+		while (draws < n) {
+			random();
+			draws++;
+		}
+	}
+}
+
+DEFINE_REPLAY(rand)
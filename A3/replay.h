@@ -0,0 +1,262 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "sim.h"
+#include "pagetable.h"
+#include "cost.h"
+#include "prof.h"
+#include "tier.h"
+
+/* The per-reference path of the simulator, written once and instantiated
+ * for each replacement algorithm.
+ *
+ * Every function here is forced inline and takes the algorithm's hooks as
+ * parameters.  When a policy file expands DEFINE_REPLAY() the hooks are
+ * constants visible in the same translation unit, so the compiler inlines
+ * them into a dedicated replay loop instead of calling through ref_fcn on
+ * every reference.  find_physpage() in pagetable.c expands the same code
+ * with the ref_fcn/evict_fcn pointers for any remaining generic callers.
+ *
+ * Faults stay out of line in handle_fault(): their cost is dominated by the
+ * eviction scan and swap I/O, not by the call.
+ *
+ * The page shift and frame size are parameters too.  DEFINE_REPLAY() expands
+ * each loop once with the default 4 KiB pages and 16-byte frames as
+ * constants, so the page table index and frame address fold to the same
+ * code as fixed sizes would, and once with the run's page_shift and
+ * simpagesize for every other geometry.
+ */
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+extern pgdir_entry_t pgdir[PTRS_PER_PGDIR];
+extern pgdir_entry_t init_second_level();
+extern void handle_fault(pgtbl_entry_t *p, addr_t vaddr, int (*evict)(void));
+
+
+// Returns the page table entry for vaddr, creating its 2nd-level table.
+ALWAYS_INLINE pgtbl_entry_t *lookup_pte_with(addr_t vaddr, unsigned shift) {
+	unsigned idx = PGDIR_INDEX(vaddr); // Get index into page directory (1st-level table).
+	pgtbl_entry_t *p;
+	PROF_SAMPLE_START(t);
+
+	// Use top-level page directory to get pointer to 2nd-level page table.
+    // Might need to initialize the 2nd-level table.
+    if (!pgdir[idx].pde) {
+        pgdir[idx] = init_second_level();
+    }
+
+	// Use vaddr to get index into the 2nd-level page table.
+    p = &((pgtbl_entry_t *)(pgdir[idx].pde & PAGE_MASK))[PGTBL_INDEX(vaddr, shift)];
+	PROF_SAMPLE_END(PROF_WALK, t);
+	return p;
+}
+
+ALWAYS_INLINE pgtbl_entry_t *lookup_pte(addr_t vaddr) {
+	return lookup_pte_with(vaddr, page_shift);
+}
+
+
+/*
+ * Makes the page for p resident and records the reference in its flags.
+ *
+ * If the entry is invalid and not on swap, then this is the first reference
+ * to the page and a (simulated) physical frame should be allocated and
+ * initialized (using init_frame).
+ *
+ * If the entry is invalid and on swap, then a (simulated) physical frame
+ * should be allocated and filled by reading the page data from swap.
+ *
+ * Counters for hit, miss and reference events are incremented here.
+ * Returns whether the reference faulted.
+ */
+ALWAYS_INLINE int touch_pte(pgtbl_entry_t *p, addr_t vaddr, char type,
+			    int (*evict)(void)) {
+	// Check if p is valid or not, on swap or not, and handle appropriately.
+    int fault = !(p->frame & PG_VALID);
+
+    // p is valid.
+    if (!fault) {
+        hit_count++;
+
+        // p is invalid.
+    } else {
+        miss_count++;
+        handle_fault(p, vaddr, evict);
+    }
+
+	// Make sure that p is marked valid and referenced.
+    p->frame = (p->frame | PG_VALID) | PG_REF;
+    ref_count++;
+
+    // Also mark it dirty if the access type indicates that the page will be written to.
+    if (type == 'M' || type == 'S') {
+        p->frame = p->frame | PG_DIRTY;
+    }
+
+    return fault;
+}
+
+
+// Returns whether p is resident in the slow memory tier.
+ALWAYS_INLINE int in_slow_tier(pgtbl_entry_t *p) {
+	return slow_frames > 0 && coremap.tier[p->frame >> PAGE_SHIFT] == TIER_SLOW;
+}
+
+
+// Returns a pointer into (simulated) physical memory at the start of p's
+// frame, whose size is fsize, or NULL in fast mode.
+ALWAYS_INLINE char *frame_ptr(pgtbl_entry_t *p, unsigned fsize) {
+	if (fast_mode) {
+		return NULL;
+	}
+	return &physmem[(size_t)(p->frame >> PAGE_SHIFT) * fsize];
+}
+
+
+/*
+ * Locate the physical frame number for the given vaddr using the page table,
+ * make it resident, and tell the replacement algorithm about the reference.
+ */
+ALWAYS_INLINE char *find_physpage_with(addr_t vaddr, char type,
+				       void (*ref)(pgtbl_entry_t *),
+				       int (*evict)(void),
+				       unsigned shift, unsigned fsize) {
+	pgtbl_entry_t *p = lookup_pte_with(vaddr, shift);
+	int fault = touch_pte(p, vaddr, type, evict);
+
+	// Call replacement algorithm's ref hook for this page, unless it is in
+	// the slow tier, which tracks its own pages.
+	if (!in_slow_tier(p) || tier_ref(p, vaddr, evict)) {
+		ref(p);
+	}
+
+	// Charge the simulated cost of this reference.
+	if (cost_enabled) {
+		cost_ref(vaddr, fault);
+	}
+
+	return frame_ptr(p, fsize);
+}
+
+
+/* Checks that the simulated page holds the expected content (a copy of the
+ * address of the page holding vaddr) and, for a write reference, increments
+ * its version counter.
+ */
+ALWAYS_INLINE void check_physpage(char *memptr, char type, addr_t vaddr,
+				  unsigned shift) {
+	int *versionptr = (int *)memptr;
+	addr_t *checkaddr = (addr_t *)(memptr + sizeof(int));
+
+	if (*checkaddr != (vaddr >> shift << shift)) {
+		fprintf(stderr,"Error, simulated page returned by pagetable lookup doese not have expected value.\n");
+	}
+
+	if (type == 'S' || type == 'M') {
+		// write access to page, increment version number
+		(*versionptr)++;
+	}
+}
+
+
+ALWAYS_INLINE void replay_refs_with(struct trace_ref *refs, int n,
+				    void (*ref)(pgtbl_entry_t *),
+				    int (*evict)(void),
+				    unsigned shift, unsigned fsize) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		char *memptr = find_physpage_with(refs[i].vaddr, refs[i].type,
+						  ref, evict, shift, fsize);
+		if (!fast_mode) {
+			check_physpage(memptr, refs[i].type, refs[i].vaddr, shift);
+		}
+	}
+}
+
+/* The batched form of replay_refs_with() for algorithms that provide a
+ * ref_batch hook.  References are resolved through the page table in
+ * order, and the frame number of each one is queued; the queue is
+ * handed to ref_batch in one call.  The queue is always flushed before a
+ * fault is handled, so the algorithm has seen every earlier reference by
+ * the time it is asked to choose a victim, and results are the same as
+ * calling ref once per reference.  The same goes for references to the
+ * slow tier, which may promote the page and so call evict.
+ */
+ALWAYS_INLINE void replay_refs_batched(struct trace_ref *refs, int n,
+				       void (*ref_batch)(unsigned *, int),
+				       int (*evict)(void),
+				       unsigned shift, unsigned fsize) {
+	unsigned frames[REPLAY_BATCH];
+	int pending = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		pgtbl_entry_t *p = lookup_pte_with(refs[i].vaddr, shift);
+		int fault;
+
+		if ((!(p->frame & PG_VALID) || in_slow_tier(p)) && pending > 0) {
+			ref_batch(frames, pending);
+			pending = 0;
+		}
+		fault = touch_pte(p, refs[i].vaddr, refs[i].type, evict);
+		if (!in_slow_tier(p) || tier_ref(p, refs[i].vaddr, evict)) {
+			frames[pending] = p->frame >> PAGE_SHIFT;
+			pending++;
+		}
+
+		if (cost_enabled) {
+			cost_ref(refs[i].vaddr, fault);
+		}
+		if (!fast_mode) {
+			check_physpage(frame_ptr(p, fsize), refs[i].type,
+				       refs[i].vaddr, shift);
+		}
+	}
+	if (pending > 0) {
+		ref_batch(frames, pending);
+	}
+}
+
+/* Defines replay_<policy>(refs, n), the replay loop for one algorithm with
+ * its <policy>_ref and <policy>_evict hooks inlined.  Expand it at the end
+ * of the policy's own source file and list it in algs[] in sim.c.
+ * Algorithms with a <policy>_ref_batch hook expand DEFINE_REPLAY_BATCH()
+ * instead, which uses it only with --batch-refs: with hooks as cheap as
+ * lru's and clock's the queue costs as much as it saves on hit-heavy runs.
+ */
+#define DEFAULT_GEOMETRY \
+	(page_shift == DEFAULT_PAGE_SHIFT && simpagesize == DEFAULT_SIMPAGESIZE)
+
+#define DEFINE_REPLAY(policy)						\
+	void replay_##policy(struct trace_ref *refs, int n) {		\
+		if (DEFAULT_GEOMETRY) {					\
+			replay_refs_with(refs, n, policy##_ref, policy##_evict, \
+					 DEFAULT_PAGE_SHIFT, DEFAULT_SIMPAGESIZE); \
+		} else {						\
+			replay_refs_with(refs, n, policy##_ref, policy##_evict, \
+					 page_shift, simpagesize);	\
+		}							\
+	}
+
+#define DEFINE_REPLAY_BATCH(policy)					\
+	void replay_##policy(struct trace_ref *refs, int n) {		\
+		if (!batch_refs && DEFAULT_GEOMETRY) {			\
+			replay_refs_with(refs, n, policy##_ref, policy##_evict, \
+					 DEFAULT_PAGE_SHIFT, DEFAULT_SIMPAGESIZE); \
+		} else if (!batch_refs) {				\
+			replay_refs_with(refs, n, policy##_ref, policy##_evict, \
+					 page_shift, simpagesize);	\
+		} else if (DEFAULT_GEOMETRY) {				\
+			replay_refs_batched(refs, n, policy##_ref_batch, \
+					    policy##_evict, DEFAULT_PAGE_SHIFT, \
+					    DEFAULT_SIMPAGESIZE);	\
+		} else {						\
+			replay_refs_batched(refs, n, policy##_ref_batch, \
+					    policy##_evict, page_shift,	\
+					    simpagesize);		\
+		}							\
+	}
+
+#endif // __REPLAY_H__
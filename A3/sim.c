@@ -4,14 +4,33 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "sim.h"
 #include "pagetable.h"
+#include "cost.h"
+#include "replay.h"
+#include "trace.h"
+#include "prof.h"
+#include "zswap.h"
+#include "tier.h"
+#include "thp.h"
+#include "arena.h"
+#include "checkpoint.h"
+#include "lackey.h"
+#include "cache.h"
+#include "part.h"
 
 // Define global variables declared in sim.h
 unsigned memsize = 0;
 int debug = 0;
+int fast_mode = 0;
+int pipeline = 0;
+int batch_refs = 0;
+unsigned long ws_window = 0;
 char *physmem = NULL;
-struct frame *coremap = NULL;
+unsigned simpagesize = DEFAULT_SIMPAGESIZE;
 char *tracefile = NULL;
 
 /* The algs array gives us a mapping between the name of an eviction
@@ -19,17 +38,101 @@ char *tracefile = NULL;
  * call to select the victim page.
  */
 struct functions algs[] = {
-	{"rand", rand_init, rand_ref, rand_evict}, 
-	{"lru", lru_init, lru_ref, lru_evict},
-	{"fifo", fifo_init, fifo_ref, fifo_evict},
-	{"clock",clock_init, clock_ref, clock_evict},
-	{"opt", opt_init, opt_ref, opt_evict}
+	{"rand", rand_init, rand_ref, rand_evict, replay_rand, NULL,
+	 rand_save, rand_restore},
+	{"lru", lru_init, lru_ref, lru_evict, replay_lru, NULL,
+	 lru_save, lru_restore, lru_move},
+	{"fifo", fifo_init, fifo_ref, fifo_evict, replay_fifo, NULL,
+	 fifo_save, fifo_restore, fifo_move},
+	{"clock",clock_init, clock_ref, clock_evict, replay_clock, NULL,
+	 clock_save, clock_restore, clock_move},
+	{"opt", opt_init, opt_ref, opt_evict, replay_opt, NULL,
+	 opt_save, opt_restore},
+	{"ws", ws_init, ws_ref, ws_evict, replay_ws, ws_report,
+	 ws_save, ws_restore},
+	{"pff", pff_init, pff_ref, pff_evict, replay_pff, pff_report,
+	 pff_save, pff_restore},
+	{"adaptive", adaptive_init, adaptive_ref, adaptive_evict, replay_adaptive,
+	 adaptive_report, adaptive_save, adaptive_restore, adaptive_move,
+	 adaptive_free_frame}
+};
+int num_algs = 8;
+
+// Options that only have a long form use values outside the char range.
+enum {
+	OPT_FAST = 256,
+	OPT_GENERIC,
+	OPT_TIMING,
+	OPT_PIPELINE,
+	OPT_BATCH_REFS,
+	OPT_CHUNKS,
+	OPT_WARMUP,
+	OPT_SUMMARY,
+	OPT_LIST_ALGS,
+	OPT_PROFILE_EVERY,
+	OPT_INTERVAL,
+	OPT_CSV,
+	OPT_NO_PAGEDIR,
+	OPT_WINDOW,
+	OPT_ZSWAP,
+	OPT_ZSWAP_RATIO,
+	OPT_SLOW_FRAMES,
+	OPT_PROMOTE,
+	OPT_THP,
+	OPT_PAGE_SIZE,
+	OPT_FRAME_SIZE,
+	OPT_MEM_STATS,
+	OPT_CHECKPOINT_EVERY,
+	OPT_CHECKPOINT,
+	OPT_RESTORE,
+	OPT_LACKEY,
+	OPT_SLIM,
+	OPT_MARKER,
+	OPT_CACHE,
+	OPT_PARTITION,
+};
+
+static struct option long_opts[] = {
+	{"fast", no_argument, NULL, OPT_FAST},
+	{"generic", no_argument, NULL, OPT_GENERIC},
+	{"timing", no_argument, NULL, OPT_TIMING},
+	{"pipeline", no_argument, NULL, OPT_PIPELINE},
+	{"batch-refs", no_argument, NULL, OPT_BATCH_REFS},
+	{"chunks", required_argument, NULL, OPT_CHUNKS},
+	{"warmup", required_argument, NULL, OPT_WARMUP},
+	{"summary", no_argument, NULL, OPT_SUMMARY},
+	{"list-algs", no_argument, NULL, OPT_LIST_ALGS},
+	{"profile-every", required_argument, NULL, OPT_PROFILE_EVERY},
+	{"interval", required_argument, NULL, OPT_INTERVAL},
+	{"csv", no_argument, NULL, OPT_CSV},
+	{"no-pagedir", no_argument, NULL, OPT_NO_PAGEDIR},
+	{"window", required_argument, NULL, OPT_WINDOW},
+	{"zswap", required_argument, NULL, OPT_ZSWAP},
+	{"zswap-ratio", required_argument, NULL, OPT_ZSWAP_RATIO},
+	{"slow-frames", required_argument, NULL, OPT_SLOW_FRAMES},
+	{"promote", required_argument, NULL, OPT_PROMOTE},
+	{"thp", required_argument, NULL, OPT_THP},
+	{"page-size", required_argument, NULL, OPT_PAGE_SIZE},
+	{"frame-size", required_argument, NULL, OPT_FRAME_SIZE},
+	{"mem-stats", no_argument, NULL, OPT_MEM_STATS},
+	{"checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY},
+	{"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+	{"restore", required_argument, NULL, OPT_RESTORE},
+	{"lackey", no_argument, NULL, OPT_LACKEY},
+	{"slim", required_argument, NULL, OPT_SLIM},
+	{"marker", required_argument, NULL, OPT_MARKER},
+	{"cache", required_argument, NULL, OPT_CACHE},
+	{"partition", required_argument, NULL, OPT_PARTITION},
+	{NULL, 0, NULL, 0}
 };
-int num_algs = 5;
 
 void (*init_fcn)() = NULL;
 void (*ref_fcn)(pgtbl_entry_t *) = NULL;
 int (*evict_fcn)() = NULL;
+void (*move_fcn)(int, int) = NULL;
+int (*free_frame_fcn)(pgtbl_entry_t *) = NULL;
+void (*replay_fcn)(struct trace_ref *, int) = NULL;
+static struct functions *alg = NULL;
 
 
 /* An actual memory access based on the vaddr from the trace file.
@@ -48,38 +151,242 @@ int (*evict_fcn)() = NULL;
  */
 void access_mem(char type, addr_t vaddr) {
 	char *memptr = find_physpage(vaddr, type);
-	int *versionptr = (int *)memptr;
-	addr_t *checkaddr = (addr_t *)(memptr + sizeof(int));
 
-	if (*checkaddr != vaddr) {
-		fprintf(stderr,"Error, simulated page returned by pagetable lookup doese not have expected value.\n");
+	if(!fast_mode) {
+		check_physpage(memptr, type, vaddr, page_shift);
 	}
-	
-	if (type == 'S' || type == 'M') {
-		// write access to page, increment version number
-		(*versionptr)++;
+}
+
+
+/* Replays a batch through the function pointers rather than a specialised
+ * loop.  Selected with --generic, mainly to measure what the specialised
+ * loops save.
+ */
+void replay_generic(struct trace_ref *refs, int n) {
+	int i;
+
+	for(i = 0; i < n; i++) {
+		access_mem(refs[i].type, refs[i].vaddr);
 	}
+}
+
 
+// Time spent inside replay_fcn, i.e. excluding trace parsing (--timing).
+static int timing = 0;
+static double replay_ns = 0;
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
 }
 
+/* Interval statistics (--interval N): one line every N references with
+ * that interval's hits, faults and evictions, and the resident set and swap
+ * slots in use at its end, as JSON or (--csv) CSV.
+ */
+static long interval = 0;
+static int csv = 0;
+static int last_hits, last_misses, last_clean, last_dirty, last_refs;
+
+static void print_interval(void) {
+	int refs = ref_count - last_refs;
+	int hits = hit_count - last_hits;
 
-void replay_trace(FILE *infp) {
-	char buf[MAXLINE];
-	addr_t vaddr = 0;
-	char type;
-
-	while(fgets(buf, MAXLINE, infp) != NULL) {
-		if(buf[0] != '=') {
-			sscanf(buf, "%c %lx", &type, &vaddr);
-			if(debug)  {
-				printf("%c %lx\n", type, vaddr);
+	if(refs == 0) {
+		return;
+	}
+	printf(csv ? "%d,%d,%d,%.4f,%d,%d,%d,%u\n" :
+	       "{\"refs\": %d, \"hits\": %d, \"faults\": %d, \"hit_rate\": %.4f, "
+	       "\"evict_clean\": %d, \"evict_dirty\": %d, \"resident\": %d, "
+	       "\"swap_used\": %u}\n",
+	       ref_count, hits, miss_count - last_misses,
+	       (double)hits/refs * 100, evict_clean_count - last_clean,
+	       evict_dirty_count - last_dirty, resident_count, swap_used());
+	last_refs = ref_count;
+	last_hits = hit_count;
+	last_misses = miss_count;
+	last_clean = evict_clean_count;
+	last_dirty = evict_dirty_count;
+}
+
+// Print a profile snapshot every profile_every references (--profile-every).
+static long profile_every = 0;
+static long next_profile = 0;
+
+static void replay_slice(struct trace_ref *refs, int n) {
+	double start;
+
+	if(!timing) {
+		replay_fcn(refs, n);
+	} else {
+		start = now_ns();
+		replay_fcn(refs, n);
+		replay_ns += now_ns() - start;
+	}
+	// khugepaged runs between batches, as a background thread would.
+	if(thp_mode == THP_KHUGEPAGED) {
+		thp_scan();
+	}
+	if(profile_every > 0 && ref_count >= next_profile) {
+		char title[64];
+
+		snprintf(title, sizeof(title), "Profile at %d references", ref_count);
+		prof_report(stderr, title);
+		next_profile = ref_count + profile_every - ref_count % profile_every;
+	}
+}
+
+/* Checkpoints (--checkpoint-every N): the whole state is written to
+ * checkpoint_file every N references.  A run started with --restore skips
+ * the skip_refs trace records the checkpoint had already replayed.
+ */
+static long checkpoint_every = 0;
+static long next_checkpoint = 0;
+static char *checkpoint_file = "sim.ckpt";
+static long skip_refs = 0;
+
+/* Replays a batch, split so that intervals end and checkpoints are taken
+ * exactly every N references.
+ */
+static void replay_batch(struct trace_ref *refs, int n) {
+	while((interval > 0 || checkpoint_every > 0) && n > 0) {
+		long k = n;
+
+		if(interval > 0 && interval - ref_count % interval < k) {
+			k = interval - ref_count % interval;
+		}
+		if(checkpoint_every > 0 && next_checkpoint - ref_count < k) {
+			k = next_checkpoint - ref_count;
+		}
+		replay_slice(refs, k);
+		if(interval > 0 && ref_count % interval == 0) {
+			print_interval();
+		}
+		if(checkpoint_every > 0 && ref_count >= next_checkpoint) {
+			checkpoint_save(checkpoint_file, alg);
+			next_checkpoint += checkpoint_every;
+		}
+		refs += k;
+		n -= k;
+	}
+	if(n > 0) {
+		replay_slice(refs, n);
+	}
+}
+
+
+static void replay_reader(struct trace_reader *tr) {
+	struct trace_ref *refs;
+	int i, n;
+
+	while((n = trace_next(tr, &refs)) > 0) {
+		if(skip_refs > 0) {
+			i = n < skip_refs ? n : skip_refs;
+			refs += i;
+			n -= i;
+			skip_refs -= i;
+		}
+		if(debug) {
+			for(i = 0; i < n; i++) {
+				printf("%c %lx\n", refs[i].type, refs[i].vaddr);
 			}
-			access_mem(type, vaddr);
-		} else {
-			continue;
 		}
+		if(cache_enabled) {
+			cache_batch(refs, n);
+		}
+		replay_batch(refs, n);
+	}
+	trace_close(tr);
+}
+
+
+void replay_trace(FILE *infp) {
+	replay_reader(trace_open(infp, pipeline ? TRACE_THREADED : 0));
+}
+
+
+/* Replays only the records in bytes [start, end) of the trace file, for
+ * the chunked mode in chunk.c.
+ */
+void replay_range(FILE *infp, long start, long end) {
+	struct trace_reader *tr;
+
+	tr = trace_open_range(infp, start, end, pipeline ? TRACE_THREADED : 0);
+	if(tr == NULL) {
+		fprintf(stderr, "Error: cannot map tracefile\n");
+		exit(1);
+	}
+	replay_reader(tr);
+}
+
 
+/* Initializes main data structures for simulation, then the replacement
+ * algorithm.  The algorithm is initialized last so that the init_fcn can
+ * refer to the coremap if needed.
+ */
+void init_sim(unsigned swapsize) {
+	// In fast mode only the metadata is simulated, so there is no physmem.
+	// The slow memory tier's frames follow the fast ones.
+	coremap_init(memsize + slow_frames);
+	if(!fast_mode) {
+		physmem = malloc((size_t)(memsize + slow_frames) * simpagesize);
+		if(physmem == NULL) {
+			perror("Failed to allocate physical memory");
+			exit(1);
+		}
 	}
+	tier_init();
+	thp_init();
+	swap_init(swapsize);
+	zswap_init();
+	init_pagetable();
+	prof_init();
+
+	// Call replacement algorithm's init_fcn before replaying trace.
+	init_fcn();
+}
+
+
+// Parses a size in bytes with an optional K, M or G suffix; 0 if invalid.
+static unsigned long parse_size(char *s) {
+	char *end;
+	unsigned long v = strtoul(s, &end, 10);
+
+	switch(*end) {
+	case 'K': case 'k':
+		v <<= 10;
+		end++;
+		break;
+	case 'M': case 'm':
+		v <<= 20;
+		end++;
+		break;
+	case 'G': case 'g':
+		v <<= 30;
+		end++;
+		break;
+	}
+	return *end == '\0' && end != s ? v : 0;
+}
+
+
+/* Prints one JSON line with the run's configuration, results, speed and
+ * peak memory use, for benchmark scripts (--summary).
+ */
+static void print_summary(char *alg, double secs) {
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("{\"trace\": \"%s\", \"alg\": \"%s\", \"memsize\": %u, "
+	       "\"fast\": %d, \"refs\": %d, \"hits\": %d, \"misses\": %d, "
+	       "\"evict_clean\": %d, \"evict_dirty\": %d, \"hit_rate\": %.4f, "
+	       "\"seconds\": %.6f, \"refs_per_sec\": %.0f, \"peak_rss_kb\": %ld}\n",
+	       tracefile ? tracefile : "-", alg, memsize, fast_mode, ref_count,
+	       hit_count, miss_count, evict_clean_count, evict_dirty_count,
+	       ref_count ? (double)hit_count/ref_count * 100 : 0.0,
+	       secs, secs > 0 ? ref_count / secs : 0.0, ru.ru_maxrss);
 }
 
 
@@ -88,9 +395,32 @@ int main(int argc, char *argv[]) {
 	unsigned swapsize = 4096;
 	FILE *tfp = stdin;
 	char *replacement_alg = NULL;
-	char *usage = "USAGE: sim -f tracefile -m memorysize -s swapsize -a algorithm\n";
+	char *usage = "USAGE: sim -f tracefile -m memorysize -s swapsize -a algorithm [-c costspec]\n"
+		"           [--fast] [--generic] [--timing] [--pipeline] [--batch-refs]\n"
+		"           [--chunks K [--warmup N]] [--summary] [--profile-every N]\n"
+		"           [--interval N [--csv]] [--no-pagedir] [--window N]\n"
+		"           [--zswap bytes[K|M|G] [--zswap-ratio R|LO-HI]]\n"
+		"           [--slow-frames N [--promote N]]\n"
+		"           [--thp always|threshold[:N]|khugepaged[:N]]\n"
+		"           [--page-size bytes[K]] [--frame-size bytes] [--mem-stats]\n"
+		"           [--checkpoint-every N [--checkpoint file]] [--restore file]\n"
+		"           [--lackey [--slim N] [--marker file]] [--cache spec] [--partition spec]\n"
+		"       sim --list-algs\n";
+	char *costspec = NULL;
+	int generic = 0;
+	int nchunks = 1;
+	long warmup = -1;
+	int summary = 0;
+	int pagedir = 1;
+	int mem_stats = 0;
+	char *restore_file = NULL;
+	int lackey_opts = 0;
+	int zswap_ratio_set = 0;
+	char *partspec = NULL;
+	void (*report_fcn)(void) = NULL;
+	double start = now_ns();
 
-	while ((opt = getopt(argc, argv, "f:m:a:s:")) != -1) {
+	while ((opt = getopt_long(argc, argv, "f:m:a:s:c:", long_opts, NULL)) != -1) {
 		switch (opt) {
 		case 'f':
 			tracefile = optarg;
@@ -104,11 +434,159 @@ int main(int argc, char *argv[]) {
 		case 's':
 			swapsize = (unsigned)strtoul(optarg, NULL, 10);
 			break;
+		case 'c':
+			costspec = optarg;
+			break;
+		case OPT_FAST:
+			fast_mode = 1;
+			break;
+		case OPT_GENERIC:
+			generic = 1;
+			break;
+		case OPT_TIMING:
+			timing = 1;
+			break;
+		case OPT_PIPELINE:
+			pipeline = 1;
+			break;
+		case OPT_BATCH_REFS:
+			batch_refs = 1;
+			break;
+		case OPT_CHUNKS:
+			nchunks = atoi(optarg);
+			if(nchunks < 2) {
+				fprintf(stderr, "Error: --chunks must be at least 2\n");
+				exit(1);
+			}
+			break;
+		case OPT_WARMUP:
+			warmup = strtol(optarg, NULL, 10);
+			break;
+		case OPT_SUMMARY:
+			summary = 1;
+			break;
+		case OPT_LIST_ALGS:
+			for (opt = 0; opt < num_algs; opt++) {
+				printf("%s\n", algs[opt].name);
+			}
+			exit(0);
+		case OPT_PROFILE_EVERY:
+			profile_every = strtol(optarg, NULL, 10);
+			next_profile = profile_every;
+			break;
+		case OPT_INTERVAL:
+			interval = strtol(optarg, NULL, 10);
+			break;
+		case OPT_CSV:
+			csv = 1;
+			break;
+		case OPT_NO_PAGEDIR:
+			pagedir = 0;
+			break;
+		case OPT_WINDOW:
+			ws_window = strtoul(optarg, NULL, 10);
+			break;
+		case OPT_SLOW_FRAMES:
+			slow_frames = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case OPT_PROMOTE: {
+			char *end;
+			unsigned long n = strtoul(optarg, &end, 10);
+
+			if(*end != '\0' || n < 1 || n > UINT_MAX) {
+				fprintf(stderr, "Error: --promote must be a positive count\n");
+				exit(1);
+			}
+			promote_threshold = n;
+			break;
+		}
+		case OPT_THP:
+			if(thp_parse(optarg) != 0) {
+				fprintf(stderr, "Error: invalid --thp mode - %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPT_PAGE_SIZE: {
+			unsigned long size = parse_size(optarg);
+
+			for(page_shift = DEFAULT_PAGE_SHIFT; page_shift < MAX_PAGE_SHIFT &&
+			    (1UL << page_shift) < size; page_shift++) {
+			}
+			if(size != 1UL << page_shift) {
+				fprintf(stderr, "Error: --page-size must be a power of 2 from 4K to 64K\n");
+				exit(1);
+			}
+			break;
+		}
+		case OPT_FRAME_SIZE:
+			simpagesize = (unsigned)strtoul(optarg, NULL, 10);
+			// A frame holds an int version counter and an addr_t.
+			if(simpagesize < DEFAULT_SIMPAGESIZE || simpagesize > 4096) {
+				fprintf(stderr, "Error: --frame-size must be between 16 and 4096\n");
+				exit(1);
+			}
+			break;
+		case OPT_MEM_STATS:
+			mem_stats = 1;
+			break;
+		case OPT_CHECKPOINT_EVERY:
+			checkpoint_every = strtol(optarg, NULL, 10);
+			if(checkpoint_every < 1) {
+				fprintf(stderr, "Error: --checkpoint-every must be at least 1\n");
+				exit(1);
+			}
+			break;
+		case OPT_CHECKPOINT:
+			checkpoint_file = optarg;
+			break;
+		case OPT_RESTORE:
+			restore_file = optarg;
+			break;
+		case OPT_LACKEY:
+			lackey_input = 1;
+			break;
+		case OPT_SLIM:
+			lackey_slim = (unsigned)strtoul(optarg, NULL, 10);
+			lackey_opts = 1;
+			break;
+		case OPT_MARKER:
+			lackey_read_marker(optarg);
+			lackey_opts = 1;
+			break;
+		case OPT_CACHE:
+			if(cache_parse(optarg) != 0) {
+				fprintf(stderr, "Error: invalid cache spec - %s\n", optarg);
+				fprintf(stderr, "Spec: default, or level=size:ways:line[:lru|fifo|rand],...\n"
+					"      for levels l1i, l1d, l2 and llc\n");
+				exit(1);
+			}
+			break;
+		case OPT_PARTITION:
+			partspec = optarg;
+			break;
+		case OPT_ZSWAP:
+			if((zswap_size = parse_size(optarg)) == 0) {
+				fprintf(stderr, "Error: invalid zswap size - %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPT_ZSWAP_RATIO:
+			zswap_ratio_set = 1;
+			if(zswap_parse_ratio(optarg) != 0) {
+				fprintf(stderr, "Error: --zswap-ratio must be R or LO-HI, ratios of at least 1\n");
+				exit(1);
+			}
+			break;
 		default:
 			fprintf(stderr, "%s", usage);
 			exit(1);
 		}
 	}
+	if((unsigned long)memsize + slow_frames > MAX_FRAMES) {
+		fprintf(stderr, "Error: -m plus --slow-frames can be at most %u frames\n",
+			MAX_FRAMES);
+		exit(1);
+	}
 	if(tracefile != NULL) {
 		if((tfp = fopen(tracefile, "r")) == NULL) {
 			perror("Error opening tracefile:");
@@ -116,13 +594,15 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	// Initialize main data structures for simulation.
-	// This happens before calling the replacement algorithm init function
-	// so that the init_fcn can refer to the coremap if needed.
-	coremap = calloc(memsize, sizeof(struct frame));
-	physmem = malloc(memsize * SIMPAGESIZE);
-	swap_init(swapsize);
-	init_pagetable();
+	if(costspec != NULL) {
+		if(cost_parse(costspec) != 0) {
+			fprintf(stderr, "Error: invalid cost spec - %s\n", costspec);
+			fprintf(stderr, "Keys: hit, tlb, zero, read, write, zload, zstore, slow, migrate,\n"
+				"      hzero (ns), tlbsize, queue\n");
+			exit(1);
+		}
+		cost_init();
+	}
 
 	// Initialize replacement algorithm functions.
 	if(replacement_alg == NULL) {
@@ -135,6 +615,11 @@ int main(int argc, char *argv[]) {
 				init_fcn = algs[i].init;
 				ref_fcn = algs[i].ref;
 				evict_fcn = algs[i].evict;
+				move_fcn = algs[i].move;
+				free_frame_fcn = algs[i].free_frame;
+				report_fcn = algs[i].report;
+				replay_fcn = generic ? replay_generic : algs[i].replay;
+				alg = &algs[i];
 				break;
 			}
 		}
@@ -144,11 +629,107 @@ int main(int argc, char *argv[]) {
 			exit(1);
 		}
 	}
-	// Call replacement algorithm's init_fcn before replaying trace.
-	init_fcn();
+	// The partitions keep their own policies, which replace the -a one's.
+	if(partspec != NULL) {
+		if(part_parse(partspec, replacement_alg) != 0) {
+			fprintf(stderr, "Error: invalid partition spec - %s\n", partspec);
+			fprintf(stderr, "Keys: code (frames, or dynamic[:frames]), code-alg, data-alg,\n"
+				"      period; the policies are rand, lru, fifo or clock (default -a)\n");
+			exit(1);
+		}
+		if(slow_frames > 0 || thp_mode != THP_NEVER || nchunks > 1 ||
+		   checkpoint_every > 0 || restore_file != NULL) {
+			fprintf(stderr, "Error: --partition cannot be used with --slow-frames, --thp,\n"
+				"       --chunks or checkpoints\n");
+			exit(1);
+		}
+		init_fcn = part_init;
+		ref_fcn = part_ref;
+		evict_fcn = part_evict;
+		free_frame_fcn = part_free_frame;
+		replay_fcn = part_replay;
+		report_fcn = part_report;
+	}
+
+	if(zswap_ratio_set && zswap_size == 0) {
+		fprintf(stderr, "Error: --zswap-ratio needs --zswap\n");
+		exit(1);
+	}
+	if(zswap_size > 0 && fast_mode) {
+		fprintf(stderr, "Error: --zswap compresses page contents, so it cannot be used with --fast\n");
+		exit(1);
+	}
+	// ws and pff free frames behind the huge page code's back, and huge
+	// pages are only built from fast frames.
+	if(thp_mode != THP_NEVER && (strcmp(replacement_alg, "ws") == 0 ||
+	   strcmp(replacement_alg, "pff") == 0 || slow_frames > 0)) {
+		fprintf(stderr, "Error: --thp cannot be used with ws, pff or --slow-frames\n");
+		exit(1);
+	}
+	if(lackey_opts && !lackey_input) {
+		fprintf(stderr, "Error: --slim and --marker need --lackey\n");
+		exit(1);
+	}
+	if(cache_enabled) {
+		// Fastslim would drop the references that hit in the caches.
+		if(lackey_input && lackey_slim != 0) {
+			fprintf(stderr, "Error: --cache needs every reference: use --slim 0 with --lackey\n");
+			exit(1);
+		}
+		if(checkpoint_every > 0 || restore_file != NULL) {
+			fprintf(stderr, "Error: --cache cannot be used with checkpoints\n");
+			exit(1);
+		}
+		lackey_bytes = 1;
+		cache_init();
+	}
+	if(profile_every > 0 && !PROF_ENABLED) {
+		fprintf(stderr, "Error: --profile-every needs sim built with make PROFILE=1\n");
+		exit(1);
+	}
 
+	if(nchunks > 1) {
+		if(strcmp(replacement_alg, "opt") == 0 || cost_enabled || interval > 0 ||
+		   checkpoint_every > 0 || restore_file != NULL || lackey_input || cache_enabled) {
+			fprintf(stderr, "Error: --chunks does not support opt, -c, --interval, checkpoints,\n"
+				"       --lackey or --cache\n");
+			exit(1);
+		}
+		// By default warm up with ten times as many references as frames.
+		if(warmup < 0) {
+			warmup = 10L * memsize;
+		}
+		run_chunks(tfp, nchunks, warmup, swapsize);
+		return(0);
+	}
+
+	if(interval > 0 && csv) {
+		printf("refs,hits,faults,hit_rate,evict_clean,evict_dirty,resident,swap_used\n");
+	}
+
+	init_sim(swapsize);
+	if(restore_file != NULL) {
+		checkpoint_restore(restore_file, alg);
+		skip_refs = ref_count;
+		last_refs = ref_count;
+		last_hits = hit_count;
+		last_misses = miss_count;
+		last_clean = evict_clean_count;
+		last_dirty = evict_dirty_count;
+	}
+	if(checkpoint_every > 0) {
+		next_checkpoint = ref_count + checkpoint_every - ref_count % checkpoint_every;
+	}
+	if(profile_every > 0) {
+		next_profile = ref_count + profile_every - ref_count % profile_every;
+	}
 	replay_trace(tfp);
-	print_pagedirectory();
+	if(interval > 0) {
+		print_interval();
+	}
+	if(pagedir) {
+		print_pagedirectory();
+	}
 
 	// Cleanup - removes temporary swapfile.
 	swap_destroy();
@@ -161,6 +742,39 @@ int main(int argc, char *argv[]) {
 	printf("Total references : %d\n", ref_count);
 	printf("Hit rate: %.4f\n", (double)hit_count/ref_count * 100);
 	printf("Miss rate: %.4f\n", (double)miss_count/ref_count *100);
+	if(report_fcn != NULL) {
+		report_fcn();
+	}
+	if(lackey_input) {
+		lackey_report();
+	}
+	if(zswap_size > 0) {
+		zswap_report();
+	}
+	if(slow_frames > 0) {
+		tier_report();
+	}
+	if(thp_mode != THP_NEVER) {
+		thp_report();
+	}
+	if(cost_enabled) {
+		cost_report();
+	}
+	if(cache_enabled) {
+		cache_report();
+	}
+	if(timing) {
+		printf("Replay time: %.2f ns/ref (parsing excluded)\n",
+		       ref_count ? replay_ns / ref_count : 0.0);
+	}
+	prof_report(stdout, "Profile");
+	if(mem_stats) {
+		arena_report();
+	}
+	if(summary) {
+		print_summary(replacement_alg, (now_ns() - start) / 1e9);
+	}
+	arena_release_all();
 		
 	return(0);
 }
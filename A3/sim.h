@@ -3,19 +3,43 @@
 
 #include "pagetable.h"
 #define MAXLINE 256
-#define SIMPAGESIZE 16  /* Simulated physical memory page frame size */
+#define DEFAULT_SIMPAGESIZE 16  /* Simulated physical memory page frame size */
 
 extern unsigned memsize;
 extern int debug;
 
+/* In fast mode only page-table, coremap and policy metadata are simulated.
+ * There is no physmem and no swap file; swap slots are still allocated so
+ * every counter matches a full run.
+ */
+extern int fast_mode;
+
+/* With pipeline set, traces are decoded on a separate parser thread (see
+ * trace.h) so parsing is off the simulation's critical path.
+ */
+extern int pipeline;
+
+/* With batch_refs set, lru and clock take their references in batches
+ * through <policy>_ref_batch (--batch-refs; see replay.h).
+ */
+extern int batch_refs;
+
 extern int hit_count;
 extern int miss_count;
 extern int ref_count;
 extern int evict_clean_count;
 extern int evict_dirty_count;
+extern int resident_count;      // Frames currently holding a page
+
+// Window of the ws and pff policies in references (--window), 0 for their
+// defaults.
+extern unsigned long ws_window;
 
 /* We simulate physical memory with a large array of bytes */
 extern char *physmem;
+// Bytes of physmem per frame (--frame-size).  A frame holds a version
+// counter and the page's address, not a whole page.
+extern unsigned simpagesize;
 
 /* The tracefile name is a global variable because the OPT
  * algorithm will need to read the file before you start
@@ -23,17 +47,58 @@ extern char *physmem;
  */
 extern char *tracefile;
 
-// Each eviction algorithm is represented by a structure with its name
-// and three functions.
+// A decoded trace record.  The trace is replayed in batches of these.
+struct trace_ref {
+	addr_t vaddr;
+	char type;
+	unsigned char size;     // Bytes accessed (lackey), 0 if not known
+};
+#define REPLAY_BATCH 4096
+
+// Each eviction algorithm is represented by a structure with its name,
+// three functions, a replay loop specialised for those functions, and
+// optionally a report of its own statistics.
 struct functions {
 	char *name;                  // String name of eviction algorithm
 	void (*init)(void);          // Initialize any data needed by alg
 	void (*ref)(pgtbl_entry_t *);    // Called on each reference
 	int (*evict)();              // Called to choose victim for eviction
+	void (*replay)(struct trace_ref *, int); // Replays a batch of refs
+	void (*report)(void);        // Prints extra statistics, or NULL
+	void (*save)(FILE *);        // Writes the policy's checkpoint section
+	void (*restore)(FILE *);     // Reads it back (see checkpoint.h)
+	void (*move)(int from, int to); // The page in frame from moved to frame
+	                             // to, or to got a new page if from is -1;
+	                             // NULL if the policy needs no notice
+	int (*free_frame)(pgtbl_entry_t *); // A free frame for the faulting
+	                             // page, or -1 to evict; NULL for the
+	                             // lowest free frame
 };
 
+extern void init_sim(unsigned swapsize);
+extern void replay_trace(FILE *infp);
+extern void replay_range(FILE *infp, long start, long end);
+extern void run_chunks(FILE *fp, int nchunks, unsigned long warmup,
+		       unsigned swapsize);
+
 extern void (*init_fcn)();
 extern void (*ref_fcn)(pgtbl_entry_t *);
 extern int (*evict_fcn)();
+extern void (*move_fcn)(int, int);
+extern int (*free_frame_fcn)(pgtbl_entry_t *);
+extern void (*replay_fcn)(struct trace_ref *, int);
+
+// One reference through the page table, as replay_generic makes it.
+extern void access_mem(char type, addr_t vaddr);
+
+// Replay loops generated by DEFINE_REPLAY() in each algorithm's file.
+extern void replay_rand(struct trace_ref *, int);
+extern void replay_lru(struct trace_ref *, int);
+extern void replay_fifo(struct trace_ref *, int);
+extern void replay_clock(struct trace_ref *, int);
+extern void replay_opt(struct trace_ref *, int);
+extern void replay_ws(struct trace_ref *, int);
+extern void replay_pff(struct trace_ref *, int);
+extern void replay_adaptive(struct trace_ref *, int);
 
 #endif // __SIM_H 
@@ -7,6 +7,7 @@
 #include <errno.h>
 #include "pagetable.h"
 #include "sim.h"
+#include "checkpoint.h"
 
 //---------------------------------------------------------------------
 // Bitmap definitions and functions to manage space in swapfile.
@@ -23,6 +24,7 @@
 struct bitmap {
         unsigned nbits;
         unsigned *v;
+        unsigned first_free;    /* No free bit in any word before this one */
 };
 
 struct bitmap *
@@ -44,6 +46,7 @@ bitmap_create(unsigned nbits)
 
         memset(b->v, 0, words*sizeof(unsigned));
         b->nbits = nbits;
+        b->first_free = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -68,8 +71,12 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
         unsigned offset;
 
-        for (ix=0; ix<maxix; ix++) {
+        /* Skip the words known to be full, so filling a large swap space
+           is linear rather than quadratic.  This still returns the lowest
+           free bit. */
+        for (ix=b->first_free; ix<maxix; ix++) {
                 if (b->v[ix]!=WORD_ALLBITS) {
+                        b->first_free = ix;
                         for (offset = 0; offset < BITS_PER_WORD; offset++) {
                                 unsigned mask = ((unsigned)1) << offset;
 
@@ -121,6 +128,9 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         assert((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        if (ix < b->first_free) {
+                b->first_free = ix;
+        }
 }
 
 
@@ -147,15 +157,22 @@ bitmap_destroy(struct bitmap *b)
 static int swapfd;
 static struct bitmap *swapmap;
 static char *fname;
+static unsigned slots_used;     // Slots allocated in swapmap
+static unsigned long pageins;   // Pages read back in
 
 int swap_init(unsigned swapsize) {
 
-	// Initialize the swap file
-	fname = malloc(20);
-	strncpy(fname, "swapfile.XXXXXX",20);
-	if ((swapfd = mkstemp(fname)) == -1) {
-		perror("Failed to create temporary file for swap");
-		exit(1);
+	// Initialize the swap file; fast mode only needs the slot bitmap.
+	if (!fast_mode) {
+		fname = malloc(20);
+		strncpy(fname, "swapfile.XXXXXX",20);
+		if ((swapfd = mkstemp(fname)) == -1) {
+			perror("Failed to create temporary file for swap");
+			exit(1);
+		}
+		// Removed at once, so the file goes away however the run ends
+		// (an error exit, or a run killed between checkpoints).
+		unlink(fname);
 	}
 
 	// Initialize the bitmap
@@ -163,15 +180,19 @@ int swap_init(unsigned swapsize) {
 		fprintf(stderr,"Failed to create bitmap for swap\n");
 		exit(1);
 	}
+	slots_used = 0;
+	pageins = 0;
 
 	return 0;
 }
 
 void swap_destroy() {
 
-	// Close and remove swapfile
-	close(swapfd);
-	unlink(fname);
+	// Close swapfile; its name was removed by swap_init()
+	if (!fast_mode) {
+		close(swapfd);
+		free(fname);
+	}
 
 	// Destroy bitmap
 	bitmap_destroy(swapmap);
@@ -185,15 +206,19 @@ void swap_destroy() {
 // Return: 0 on success, 
 //	   -errno on error or number of bytes read on partial read
 // 
-int swap_pagein(unsigned frame, int swap_offset) {
+int swap_pagein(unsigned frame, off_t swap_offset) {
 	char *frame_ptr;
 	off_t pos;
 	ssize_t bytes_read;
 	
 	assert(swap_offset != INVALID_SWAP);
+	pageins++;
+	if (fast_mode) {
+		return 0;
+	}
 
 	// Get pointer to page data in (simulated) physical memory
-	frame_ptr = &physmem[frame * SIMPAGESIZE];
+	frame_ptr = &physmem[(size_t)frame * simpagesize];
 
 	// Seek to position in swap file where this page was stored
 	pos = lseek(swapfd, swap_offset, SEEK_SET);
@@ -204,8 +229,8 @@ int swap_pagein(unsigned frame, int swap_offset) {
 	}
 
 	// Read page data from swapfile into memory
-	bytes_read = read(swapfd, frame_ptr, SIMPAGESIZE);
-	if (bytes_read != SIMPAGESIZE) {
+	bytes_read = read(swapfd, frame_ptr, simpagesize);
+	if (bytes_read != simpagesize) {
 		fprintf(stderr,"swap_pagein: did not read whole page\n");
 		return bytes_read;
 	}
@@ -219,8 +244,14 @@ int swap_pagein(unsigned frame, int swap_offset) {
 // Return: the swap_offset where the data was written on success,
 //         or INVALID_SWAP on failure
 // 
-int swap_pageout(unsigned frame, int swap_offset) {
-	char *frame_ptr;
+off_t swap_pageout(unsigned frame, off_t swap_offset) {
+	return swap_pageout_data(fast_mode ? NULL : &physmem[(size_t)frame * simpagesize],
+				 swap_offset);
+}
+
+// As swap_pageout(), but writes the simpagesize bytes at frame_ptr, which
+// need not be in physmem (the compressed tier spills from a buffer).
+off_t swap_pageout_data(char *frame_ptr, off_t swap_offset) {
 	off_t pos;
 	unsigned idx;
 	ssize_t bytes_written;
@@ -231,12 +262,13 @@ int swap_pageout(unsigned frame, int swap_offset) {
 			fprintf(stderr,"swap_pageout: Could not allocate space in swapfile. Try running again with a larger swapsize.\n");
 			return INVALID_SWAP;
 		}
-		swap_offset = idx*SIMPAGESIZE;
+		swap_offset = (off_t)idx * simpagesize;
+		slots_used++;
 	}
 	assert(swap_offset != INVALID_SWAP);
-
-	// Get pointer to page data in (simulated) physical memory
-	frame_ptr = &physmem[frame * SIMPAGESIZE];
+	if (fast_mode) {
+		return swap_offset;
+	}
 
 	// Seek to position in swap file where this page will be stored
 	pos = lseek(swapfd, swap_offset, SEEK_SET);
@@ -247,10 +279,96 @@ int swap_pageout(unsigned frame, int swap_offset) {
 	}
 
 	// Read page data from swapfile into memory
-	bytes_written = write(swapfd, frame_ptr, SIMPAGESIZE);
-	if (bytes_written != SIMPAGESIZE) {
+	bytes_written = write(swapfd, frame_ptr, simpagesize);
+	if (bytes_written != simpagesize) {
 		fprintf(stderr,"swap_pageout: did not write whole page\n");
 		return INVALID_SWAP;
 	}
 	return swap_offset;
 }
+
+// Returns the number of swap slots holding a page.
+unsigned swap_used() {
+	return slots_used;
+}
+
+// Returns the number of pages read in from the swap file.
+unsigned long swap_pageins() {
+	return pageins;
+}
+
+// Size of the pieces the swap file is copied in.
+#define SWAP_COPY_CHUNK (1 << 20)
+
+/* Checkpoint section: the slot bitmap and counters, then (unless in fast
+ * mode) the swap file up to its last used slot, copied in large pieces.
+ */
+void swap_save(FILE *fp) {
+	unsigned words = DIVROUNDUP(swapmap->nbits, BITS_PER_WORD);
+	off_t len = 0;
+
+	CKPT_WRITE(fp, swapmap->nbits);
+	ckpt_write(fp, swapmap->v, words * sizeof(unsigned));
+	CKPT_WRITE(fp, swapmap->first_free);
+	CKPT_WRITE(fp, slots_used);
+	CKPT_WRITE(fp, pageins);
+	if (fast_mode) {
+		return;
+	}
+
+	if ((len = lseek(swapfd, 0, SEEK_END)) == (off_t)-1) {
+		perror("Failed to size swap file");
+		exit(1);
+	}
+	CKPT_WRITE(fp, len);
+	if (len > 0) {
+		char *buf = malloc(SWAP_COPY_CHUNK);
+		off_t pos;
+
+		for (pos = 0; pos < len; pos += SWAP_COPY_CHUNK) {
+			size_t n = len - pos < SWAP_COPY_CHUNK ? len - pos : SWAP_COPY_CHUNK;
+
+			if (pread(swapfd, buf, n, pos) != (ssize_t)n) {
+				perror("Failed to read swap file");
+				exit(1);
+			}
+			ckpt_write(fp, buf, n);
+		}
+		free(buf);
+	}
+}
+
+void swap_restore(FILE *fp) {
+	unsigned nbits;
+	off_t len;
+
+	CKPT_READ(fp, nbits);
+	if (nbits != swapmap->nbits) {
+		fprintf(stderr, "Error: checkpoint was made with a swap size of %u pages\n", nbits);
+		exit(1);
+	}
+	ckpt_read(fp, swapmap->v, DIVROUNDUP(nbits, BITS_PER_WORD) * sizeof(unsigned));
+	CKPT_READ(fp, swapmap->first_free);
+	CKPT_READ(fp, slots_used);
+	CKPT_READ(fp, pageins);
+	if (fast_mode) {
+		return;
+	}
+
+	CKPT_READ(fp, len);
+	if (len > 0) {
+		char *buf = malloc(SWAP_COPY_CHUNK);
+		off_t pos;
+
+		for (pos = 0; pos < len; pos += SWAP_COPY_CHUNK) {
+			size_t n = len - pos < SWAP_COPY_CHUNK ? len - pos : SWAP_COPY_CHUNK;
+
+			ckpt_read(fp, buf, n);
+			if (pwrite(swapfd, buf, n, pos) != (ssize_t)n) {
+				perror("Failed to write swap file");
+				exit(1);
+			}
+		}
+		free(buf);
+	}
+}
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "cost.h"
+#include "replay.h"
+#include "thp.h"
+#include "arena.h"
+#include "checkpoint.h"
+
+int thp_mode = THP_NEVER;
+unsigned thp_threshold = 0;
+
+#define THP_SCAN_REGIONS 8      // Regions khugepaged looks at per batch
+
+// For each block of frames, 1 + the number of the 2 MiB region mapped to
+// it by a huge page (its directory index * PMDS_PER_PGTBL + HPAGE_INDEX),
+// or 0.
+static unsigned *block_region;
+
+static unsigned scan_dir, scan_pmd;     // khugepaged's position
+
+static unsigned long huge_faults;
+static unsigned long collapses;
+static unsigned long fallbacks;
+static unsigned long splits;
+
+
+/* Parses "always", "threshold[:N]" or "khugepaged[:N]".  Returns 0 on
+ * success, -1 on a malformed spec.
+ */
+int thp_parse(char *spec) {
+	char *colon = strchr(spec, ':');
+	size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+	if (strncmp(spec, "never", len) == 0 && len == 5) {
+		thp_mode = THP_NEVER;
+	} else if (strncmp(spec, "always", len) == 0 && len == 6) {
+		thp_mode = THP_ALWAYS;
+	} else if (strncmp(spec, "threshold", len) == 0 && len == 9) {
+		thp_mode = THP_THRESHOLD;
+	} else if (strncmp(spec, "khugepaged", len) == 0 && len == 10) {
+		thp_mode = THP_KHUGEPAGED;
+	} else {
+		return -1;
+	}
+	if (colon != NULL) {
+		char *end;
+
+		thp_threshold = strtoul(colon + 1, &end, 10);
+		if (*end != '\0' || thp_threshold < 1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void thp_init() {
+	if (thp_threshold == 0) {
+		thp_threshold = HPAGE_NR / 8;
+	} else if (thp_threshold > HPAGE_NR) {
+		fprintf(stderr, "Error: --thp threshold must be at most %u with this page size\n",
+			HPAGE_NR);
+		exit(1);
+	}
+	block_region = arena_calloc(&meta_arena, memsize / HPAGE_NR + 1,
+				    sizeof(unsigned));
+	scan_dir = scan_pmd = 0;
+	huge_faults = collapses = fallbacks = splits = 0;
+}
+
+int thp_is_huge(addr_t vaddr) {
+	return (pgdir[PGDIR_INDEX(vaddr)].pde & PDE_HUGE(HPAGE_INDEX(vaddr))) != 0;
+}
+
+// Marks the region at base huge, mapped to the block at frame block.
+static void set_huge(addr_t base, int block) {
+	pgdir[PGDIR_INDEX(base)].pde |= PDE_HUGE(HPAGE_INDEX(base));
+	block_region[block / HPAGE_NR] =
+		PGDIR_INDEX(base) * PMDS_PER_PGTBL + HPAGE_INDEX(base) + 1;
+}
+
+// First frame of an aligned block of free frames, or -1 if there is none.
+static int find_free_block(void) {
+	unsigned block, i;
+
+	if (coremap.nfree < HPAGE_NR) {
+		return -1;
+	}
+	for (block = 0; block + HPAGE_NR <= memsize; block += HPAGE_NR) {
+		for (i = 0; i < HPAGE_NR && !coremap.in_use[block + i]; i++) {
+		}
+		if (i == HPAGE_NR) {
+			return block;
+		}
+	}
+	return -1;
+}
+
+// Number of resident pages among the region's ptes.
+static unsigned resident_in(pgtbl_entry_t *ptes) {
+	unsigned i, n = 0;
+
+	for (i = 0; i < HPAGE_NR; i++) {
+		n += ptes[i].frame & PG_VALID;
+	}
+	return n;
+}
+
+/* Maps the 2 MiB region at base with a huge page: resident pages are
+ * moved into a free block and the rest of the block is zero-filled.  The
+ * policy is told of each move and each new page, so the block starts with
+ * its pages' ages rather than those of the frames' previous occupants.
+ * Returns 0, leaving the region alone, if a page is on swap or there is
+ * no free block.
+ */
+static int collapse(addr_t base) {
+	pgtbl_entry_t *ptes = lookup_pte(base);
+	int block, i;
+
+	for (i = 0; i < HPAGE_NR; i++) {
+		if ((ptes[i].frame & (PG_VALID | PG_ONSWAP)) == PG_ONSWAP) {
+			return 0;
+		}
+	}
+	if ((block = find_free_block()) < 0) {
+		return 0;
+	}
+
+	for (i = 0; i < HPAGE_NR; i++) {
+		pgtbl_entry_t *q = &ptes[i];
+		int frame = block + i;
+
+		if (q->frame & PG_VALID) {
+			int old = q->frame >> PAGE_SHIFT;
+
+			if (!fast_mode) {
+				memcpy(&physmem[(size_t)frame * simpagesize],
+				       &physmem[(size_t)old * simpagesize], simpagesize);
+			}
+			mark_frame_free(old);
+			coremap.pte[old] = NULL;
+			q->frame = (frame << PAGE_SHIFT) | (q->frame & ~PAGE_MASK);
+			if (move_fcn != NULL) {
+				move_fcn(old, frame);
+			}
+		} else {
+			if (!fast_mode) {
+				init_frame(frame, base + ((addr_t)i << page_shift));
+			}
+			// Like any zero-filled page, it has no copy on swap yet.
+			q->frame = (frame << PAGE_SHIFT) | PG_VALID | PG_ONSWAP | PG_DIRTY;
+			resident_count++;
+			if (move_fcn != NULL) {
+				move_fcn(-1, frame);
+			}
+		}
+		mark_frame_used(frame);
+		coremap.pte[frame] = q;
+	}
+	set_huge(base, block);
+	if (cost_enabled) {
+		cost_huge_fill();
+	}
+	return 1;
+}
+
+/* Called at the start of a fault.  Maps the faulting page as part of a new
+ * huge page if the mode allows it and returns 1; otherwise returns 0 and
+ * the fault allocates a base page.
+ */
+int thp_fault(pgtbl_entry_t *p, addr_t vaddr) {
+	addr_t base = vaddr & ~(((addr_t)1 << HPAGE_SHIFT) - 1);
+
+	if (thp_mode == THP_KHUGEPAGED ||
+	    (thp_mode == THP_THRESHOLD &&
+	     resident_in(lookup_pte(base)) + 1 < thp_threshold)) {
+		return 0;
+	}
+	if (!collapse(base)) {
+		fallbacks++;
+		return 0;
+	}
+	huge_faults++;
+	return 1;
+}
+
+/* Called with each victim chosen by the replacement algorithm: a huge page
+ * is split into base pages, so only the victim page leaves memory.
+ */
+void thp_split_frame(int frame) {
+	unsigned *slot = &block_region[frame / HPAGE_NR];
+
+	if (frame < (memsize / HPAGE_NR) * HPAGE_NR && *slot != 0) {
+		unsigned region = *slot - 1;
+
+		pgdir[region / PMDS_PER_PGTBL].pde &= ~PDE_HUGE(region % PMDS_PER_PGTBL);
+		*slot = 0;
+		splits++;
+	}
+}
+
+/* One khugepaged pass: looks at the next THP_SCAN_REGIONS regions with a
+ * page table and collapses those with at least thp_threshold resident
+ * pages.
+ */
+void thp_scan() {
+	int seen = 0, dirs = 0;
+
+	while (seen < THP_SCAN_REGIONS && dirs <= PTRS_PER_PGDIR) {
+		addr_t base = ((addr_t)scan_dir << PGDIR_SHIFT) |
+			((addr_t)scan_pmd << HPAGE_SHIFT);
+
+		if (!(pgdir[scan_dir].pde & PG_VALID)) {
+			scan_pmd = PMDS_PER_PGTBL - 1;
+		} else {
+			seen++;
+			if (!thp_is_huge(base) &&
+			    resident_in(lookup_pte(base)) >= thp_threshold &&
+			    collapse(base)) {
+				collapses++;
+			}
+		}
+		if (++scan_pmd == PMDS_PER_PGTBL) {
+			scan_pmd = 0;
+			scan_dir = (scan_dir + 1) % PTRS_PER_PGDIR;
+			dirs++;
+		}
+	}
+}
+
+/* Checkpoint section: block_region, then khugepaged's position and the
+ * counters.  The directory's huge bits are set again from block_region,
+ * after the page tables have been restored.
+ */
+void thp_save(FILE *fp) {
+	ckpt_write(fp, block_region, (memsize / HPAGE_NR + 1) * sizeof(unsigned));
+	CKPT_WRITE(fp, scan_dir);
+	CKPT_WRITE(fp, scan_pmd);
+	CKPT_WRITE(fp, huge_faults);
+	CKPT_WRITE(fp, collapses);
+	CKPT_WRITE(fp, fallbacks);
+	CKPT_WRITE(fp, splits);
+}
+
+void thp_restore(FILE *fp) {
+	unsigned i, region;
+
+	ckpt_read(fp, block_region, (memsize / HPAGE_NR + 1) * sizeof(unsigned));
+	for (i = 0; i <= memsize / HPAGE_NR; i++) {
+		if ((region = block_region[i]) == 0) {
+			continue;
+		}
+		region--;
+		if (region / PMDS_PER_PGTBL >= PTRS_PER_PGDIR ||
+		    !(pgdir[region / PMDS_PER_PGTBL].pde & PG_VALID)) {
+			fprintf(stderr, "Error: corrupt huge page table in checkpoint\n");
+			exit(1);
+		}
+		pgdir[region / PMDS_PER_PGTBL].pde |= PDE_HUGE(region % PMDS_PER_PGTBL);
+	}
+	CKPT_READ(fp, scan_dir);
+	CKPT_READ(fp, scan_pmd);
+	CKPT_READ(fp, huge_faults);
+	CKPT_READ(fp, collapses);
+	CKPT_READ(fp, fallbacks);
+	CKPT_READ(fp, splits);
+}
+
+/* Prints how huge pages were made and split, and the memory bloat: frames
+ * that are mapped but were never referenced.
+ */
+void thp_report() {
+	unsigned i, huge = 0, bloat = 0;
+
+	for (i = 0; i < memsize / HPAGE_NR; i++) {
+		huge += block_region[i] != 0;
+	}
+	for (i = 0; i < memsize; i++) {
+		if (coremap.in_use[i] && !(coremap.pte[i]->frame & PG_REF)) {
+			bloat++;
+		}
+	}
+	printf("\n");
+	printf("Huge page faults: %lu\n", huge_faults);
+	printf("Huge page collapses: %lu\n", collapses);
+	printf("Huge page fallbacks: %lu\n", fallbacks);
+	printf("Huge page splits: %lu\n", splits);
+	printf("Huge pages mapped: %u (%u frames)\n", huge, huge * HPAGE_NR);
+	printf("Bloat: %u frames mapped but never referenced\n", bloat);
+}
@@ -0,0 +1,44 @@
+#ifndef __THP_H__
+#define __THP_H__
+
+#include "pagetable.h"
+
+/* Transparent huge pages.
+ * A huge page maps an aligned 2 MiB region with an aligned block of
+ * HPAGE_NR contiguous frames.  The region is marked huge in the page
+ * directory entry, whose PDE_HUGE bits act as the pmd level between the
+ * directory and the page tables.  The ptes are filled in as well, so a
+ * reference to any page of the region is still a plain pte hit, the
+ * replay loops need no extra check, and a split keeps each page's dirty
+ * and reference bits.  The cost model's TLB reads the directory entry and
+ * caches a huge region as a single entry.
+ *
+ * Huge pages are made:
+ *   always      on the first fault in a region, if a free block exists
+ *   threshold   on a fault in a region with at least thp_threshold
+ *               resident pages, collapsing them into a block
+ *   khugepaged  by a background scan that collapses such regions, a few
+ *               regions after every replay batch
+ * Regions with a swapped-out page are never collapsed.  When the
+ * replacement algorithm picks a frame of a huge page as a victim, the
+ * huge page is split and only that page is evicted.
+ */
+#define HPAGE_SHIFT     21
+#define HPAGE_NR        (1U << (HPAGE_SHIFT - page_shift))
+#define PMDS_PER_PGTBL  (1U << (PGDIR_SHIFT - HPAGE_SHIFT))
+#define HPAGE_INDEX(x)  (((x) >> HPAGE_SHIFT) % PMDS_PER_PGTBL)
+
+enum thp_mode { THP_NEVER, THP_ALWAYS, THP_THRESHOLD, THP_KHUGEPAGED };
+
+extern int thp_mode;
+extern unsigned thp_threshold;         // 0 = HPAGE_NR / 8
+
+extern int thp_parse(char *spec);
+extern void thp_init(void);
+extern int thp_fault(pgtbl_entry_t *p, addr_t vaddr);
+extern void thp_split_frame(int frame);
+extern void thp_scan(void);
+extern int thp_is_huge(addr_t vaddr);
+extern void thp_report(void);
+
+#endif // __THP_H__
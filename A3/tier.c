@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "cost.h"
+#include "tier.h"
+#include "arena.h"
+#include "checkpoint.h"
+
+unsigned slow_frames = 0;
+unsigned promote_threshold = 4;
+
+// Per slow frame, indexed by frame - memsize.
+static unsigned *counts;        // Accesses since the page was demoted
+static unsigned char *ref_bits; // Reference bits for the slow tier's CLOCK
+static unsigned hand;
+
+static unsigned long slow_accesses;
+static unsigned long promotions;
+static unsigned long demotions;
+
+
+// Sets the frame number in p, keeping its status bits.
+static void set_frame(pgtbl_entry_t *p, int frame) {
+	p->frame = ((unsigned)frame << PAGE_SHIFT) | (p->frame & ~PAGE_MASK);
+}
+
+// Charges one page migration to the cost model.
+static void migrated(void) {
+	if (cost_enabled) {
+		cost_migrate();
+	}
+}
+
+/* Returns a slow frame to demote into: a free one if the CLOCK hand finds
+ * one first, otherwise the first page with a clear reference bit, which is
+ * evicted to swap.
+ */
+static int slow_victim(void) {
+	for (;;) {
+		int frame = memsize + hand;
+
+		hand = (hand + 1) % slow_frames;
+		if (!coremap.in_use[frame]) {
+			mark_frame_used(frame);
+			resident_count++;
+			return frame;
+		}
+		if (!ref_bits[frame - memsize]) {
+			evict_page(frame);
+			return frame;
+		}
+		ref_bits[frame - memsize] = 0;
+	}
+}
+
+/* Moves the page in fast frame frame to the slow tier, which leaves frame
+ * free for allocate_frame() to reuse.
+ */
+void tier_demote(int frame) {
+	pgtbl_entry_t *p = coremap.pte[frame];
+	int slow = slow_victim();
+
+	if (!fast_mode) {
+		memcpy(&physmem[(size_t)slow * simpagesize], &physmem[(size_t)frame * simpagesize],
+		       simpagesize);
+	}
+	set_frame(p, slow);
+	coremap.pte[slow] = p;
+	counts[slow - memsize] = 0;
+	ref_bits[slow - memsize] = 0;
+	coremap.pte[frame] = NULL;
+	demotions++;
+	migrated();
+}
+
+/* Promotes the page in slow frame slow to a free fast frame if there is
+ * one, or else swaps it with a fast victim chosen by evict.
+ */
+static void promote(int slow, addr_t vaddr, int (*evict)(void)) {
+	pgtbl_entry_t *p = coremap.pte[slow];
+	pgtbl_entry_t *v;
+	char tmp[simpagesize];
+	int frame = find_free_frame();
+
+	if (frame != -1) {
+		if (!fast_mode) {
+			memcpy(&physmem[(size_t)frame * simpagesize],
+			       &physmem[(size_t)slow * simpagesize], simpagesize);
+		}
+		set_frame(p, frame);
+		mark_frame_used(frame);
+		coremap.pte[frame] = p;
+		mark_frame_free(slow);
+		coremap.pte[slow] = NULL;
+	} else {
+		fault_vaddr = vaddr;
+		frame = evict();
+		v = coremap.pte[frame];
+		if (!fast_mode) {
+			memcpy(tmp, &physmem[(size_t)frame * simpagesize], simpagesize);
+			memcpy(&physmem[(size_t)frame * simpagesize],
+			       &physmem[(size_t)slow * simpagesize], simpagesize);
+			memcpy(&physmem[(size_t)slow * simpagesize], tmp, simpagesize);
+		}
+		set_frame(p, frame);
+		set_frame(v, slow);
+		coremap.pte[frame] = p;
+		coremap.pte[slow] = v;
+		counts[slow - memsize] = 0;
+		ref_bits[slow - memsize] = 0;
+		demotions++;
+		migrated();
+	}
+	promotions++;
+	migrated();
+}
+
+/* Records a reference to a page in the slow tier, promoting it once it is
+ * hot.  Returns whether the page is now in the fast tier, in which case
+ * the caller passes the reference on to the replacement algorithm.
+ */
+int tier_ref(pgtbl_entry_t *p, addr_t vaddr, int (*evict)(void)) {
+	int slow = p->frame >> PAGE_SHIFT;
+
+	slow_accesses++;
+	if (cost_enabled) {
+		cost_slow_access();
+	}
+	ref_bits[slow - memsize] = 1;
+	if (++counts[slow - memsize] < promote_threshold) {
+		return 0;
+	}
+	promote(slow, vaddr, evict);
+	return 1;
+}
+
+void tier_init() {
+	unsigned i;
+
+	for (i = 0; i < memsize + slow_frames; i++) {
+		coremap.tier[i] = i < memsize ? TIER_FAST : TIER_SLOW;
+	}
+	counts = arena_calloc(&meta_arena, slow_frames, sizeof(unsigned));
+	ref_bits = arena_calloc(&meta_arena, slow_frames, sizeof(unsigned char));
+	hand = 0;
+	slow_accesses = promotions = demotions = 0;
+}
+
+/* Prints accesses, migrations and the access time spent in each tier,
+ * using the cost model's latencies (its defaults unless -c is given).
+ */
+// Checkpoint section: the slow tier's counters, CLOCK state and stats.
+void tier_save(FILE *fp) {
+	ckpt_write(fp, counts, slow_frames * sizeof(unsigned));
+	ckpt_write(fp, ref_bits, slow_frames);
+	CKPT_WRITE(fp, hand);
+	CKPT_WRITE(fp, slow_accesses);
+	CKPT_WRITE(fp, promotions);
+	CKPT_WRITE(fp, demotions);
+}
+
+void tier_restore(FILE *fp) {
+	ckpt_read(fp, counts, slow_frames * sizeof(unsigned));
+	ckpt_read(fp, ref_bits, slow_frames);
+	CKPT_READ(fp, hand);
+	CKPT_READ(fp, slow_accesses);
+	CKPT_READ(fp, promotions);
+	CKPT_READ(fp, demotions);
+}
+
+void tier_report() {
+	unsigned long fast_accesses = ref_count - slow_accesses;
+	double fast_ns = (double)fast_accesses * cost.hit;
+	double slow_ns = (double)slow_accesses * (cost.hit + cost.slow);
+	double migrate_ns = (double)(promotions + demotions) * cost.migrate;
+
+	printf("\n");
+	printf("Fast tier: %u frames, %lu accesses, %.0f ns\n",
+	       memsize, fast_accesses, fast_ns);
+	printf("Slow tier: %u frames, %lu accesses, %.0f ns\n",
+	       slow_frames, slow_accesses, slow_ns);
+	printf("Promotions: %lu\n", promotions);
+	printf("Demotions: %lu\n", demotions);
+	printf("Migration time: %.0f ns\n", migrate_ns);
+	printf("Slow tier access share: %.4f\n",
+	       ref_count ? (double)slow_accesses / ref_count * 100 : 0.0);
+}
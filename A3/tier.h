@@ -0,0 +1,30 @@
+#ifndef __TIER_H__
+#define __TIER_H__
+
+#include "pagetable.h"
+
+/* Two-tier memory: memsize fast frames (DRAM) followed by slow_frames slow
+ * frames (CXL/PMEM) in the same coremap, told apart by coremap.tier[].
+ *
+ * New pages always go to the fast tier, which the replacement algorithm
+ * manages as usual.  Its victims are demoted to the slow tier instead of
+ * being swapped out; only when the slow tier is full does its own CLOCK
+ * hand pick a page to write to swap.  Slow pages stay mapped and are
+ * accessed in place, and each access bumps a per-frame count; a page
+ * reaching promote_threshold accesses swaps places with a fast victim.
+ *
+ * The replacement algorithm only ever sees fast frames: references to slow
+ * pages go to tier_ref() instead of its ref hook.
+ */
+#define TIER_FAST 0
+#define TIER_SLOW 1
+
+extern unsigned slow_frames;            // 0 = a single tier
+extern unsigned promote_threshold;
+
+extern void tier_init(void);
+extern void tier_demote(int frame);
+extern int tier_ref(pgtbl_entry_t *p, addr_t vaddr, int (*evict)(void));
+extern void tier_report(void);
+
+#endif // __TIER_H__
@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "sim.h"
+#include "trace.h"
+#include "tracefmt.h"
+#include "lackey.h"
+
+#define RING_SLOTS 8    // Batches in flight between parser and simulator
+#define SPIN_LIMIT 64   // Busy-wait this many times before yielding the CPU
+
+struct trace_reader {
+	FILE *fp;
+
+	// A regular file is mapped and decoded in place.  blk is the start of
+	// the 64-byte block whose newline positions are in nl_mask.
+	const char *map;
+	size_t map_len;
+	const char *pos;
+	const char *end;
+	const char *blk;
+	uint64_t nl_mask;
+
+	int binary;     // A binary trace (see tracefmt.h)
+	struct lackey *lk;      // Raw lackey output (see lackey.h)
+
+	// sscanf leaves these unchanged when it cannot parse a field, so
+	// they carry over between lines exactly as in the original
+	// fgets/sscanf loop.
+	addr_t vaddr;
+	char type;
+
+	int threaded;
+	pthread_t thread;
+	struct trace_ref (*slots)[REPLAY_BATCH];
+	int count[RING_SLOTS];
+	int holding;    // Consumer still holds slot tail
+	int done;       // Consumer has seen the end of the trace
+	int stop;       // Consumer asks the parser to quit early
+
+	// head is written only by the parser, tail only by the consumer.
+	// They sit on separate cache lines so the two threads do not
+	// invalidate each other's line on every batch.
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long tail __attribute__((aligned(64)));
+};
+
+
+// Value of each hex digit, 0xff for any other character.
+static const unsigned char hexval[256] = {
+	[0 ... 255] = 0xff,
+	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+
+// Decodes up to max references with fgets/sscanf.  Returns fewer than max
+// only at the end.
+static int read_batch_stdio(struct trace_reader *tr, struct trace_ref *refs, int max) {
+	char buf[MAXLINE];
+	int n = 0;
+
+	while (n < max && fgets(buf, MAXLINE, tr->fp) != NULL) {
+		if (buf[0] == '=') {
+			continue;
+		}
+		sscanf(buf, "%c %lx", &tr->type, &tr->vaddr);
+		refs[n].type = tr->type;
+		refs[n].vaddr = tr->vaddr;
+		refs[n].size = 0;
+		n++;
+	}
+	return n;
+}
+
+
+// Bit i is set if p[i] is a newline.
+static inline uint64_t newline_mask(const char *p) {
+#ifdef __SSE2__
+	const __m128i nl = _mm_set1_epi8('\n');
+	uint64_t m0 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)p), nl));
+	uint64_t m1 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + 16)), nl));
+	uint64_t m2 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + 32)), nl));
+	uint64_t m3 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + 48)), nl));
+
+	return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#else
+	uint64_t m = 0;
+	int i;
+
+	for (i = 0; i < 64; i++) {
+		m |= (uint64_t)(p[i] == '\n') << i;
+	}
+	return m;
+#endif
+}
+
+// Indexes the 64-byte block containing p.  Blocks are aligned to the start
+// of the mapping, which is page-aligned.
+static void load_block(struct trace_reader *tr, const char *p) {
+	const char *blk = tr->map + ((p - tr->map) & ~(size_t)63);
+	char tail[64];
+
+	tr->blk = blk;
+	if (tr->end - blk >= 64) {
+		tr->nl_mask = newline_mask(blk);
+	} else {
+		// Pad the last partial block so we never read past the mapping.
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, blk, tr->end - blk);
+		tr->nl_mask = newline_mask(tail);
+	}
+}
+
+// Returns the first newline at or after p, or tr->end if there is none.
+static inline const char *next_newline(struct trace_reader *tr, const char *p) {
+	uint64_t m;
+
+	// A record cut short at MAXLINE-1 can leave p behind the block that
+	// the search for its newline ended in.
+	if (p < tr->blk || p >= tr->blk + 64) {
+		load_block(tr, p);
+	}
+	m = tr->nl_mask & (~(uint64_t)0 << (p - tr->blk));
+	while (m == 0) {
+		if (tr->blk + 64 >= tr->end) {
+			return tr->end;
+		}
+		load_block(tr, tr->blk + 64);
+		m = tr->nl_mask;
+	}
+	return tr->blk + __builtin_ctzll(m);
+}
+
+static inline int is_space(unsigned char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* Decodes one fgets-sized record [s, e), not counting its newline, with
+ * the same results as sscanf(buf, "%c %lx", &type, &vaddr): fields that do
+ * not parse leave the previous values in place, and on an empty line %c
+ * reads the newline itself.
+ */
+static inline void parse_record(struct trace_reader *tr, const char *s,
+				const char *e) {
+	unsigned long v = 0;
+	int neg = 0, digits = 0, overflow = 0;
+	unsigned d;
+
+	if (s == e) {
+		tr->type = '\n';
+		return;
+	}
+	if (*s == '\0') {
+		return;  // sscanf sees an empty string
+	}
+	tr->type = *s++;
+	while (s < e && is_space(*s)) {
+		s++;
+	}
+	if (s < e && (*s == '-' || *s == '+')) {
+		neg = (*s == '-');
+		s++;
+	}
+	if (e - s > 2 && s[0] == '0' && (s[1] | 0x20) == 'x' &&
+	    hexval[(unsigned char)s[2]] < 16) {
+		s += 2;
+	}
+	while (s < e && (d = hexval[(unsigned char)*s]) < 16) {
+		overflow |= (v >> 60) != 0;
+		v = (v << 4) | d;
+		digits++;
+		s++;
+	}
+	if (digits == 0) {
+		return;
+	}
+	if (overflow) {
+		v = ULONG_MAX;
+	} else if (neg) {
+		v = -v;
+	}
+	tr->vaddr = v;
+}
+
+/* Decodes up to max references straight out of the mapped file.  Lines are
+ * found with the SIMD newline index and split at MAXLINE-1 characters the
+ * way fgets splits them, so the records match read_batch_stdio() exactly.
+ */
+static int read_batch_mmap(struct trace_reader *tr, struct trace_ref *refs, int max) {
+	const char *p = tr->pos;
+	int n = 0;
+
+	while (n < max && p < tr->end) {
+		const char *nl = next_newline(tr, p);
+		const char *e = nl;
+		int has_nl = (nl < tr->end);
+
+		// fgets returns at most MAXLINE-1 characters including the '\n'.
+		if (e - p + has_nl > MAXLINE - 1) {
+			e = p + MAXLINE - 1;
+			has_nl = 0;
+		}
+		if (*p != '=') {
+			parse_record(tr, p, e);
+			refs[n].type = tr->type;
+			refs[n].vaddr = tr->vaddr;
+			refs[n].size = 0;
+			n++;
+		}
+		p = e + has_nl;
+	}
+	tr->pos = p;
+	return n;
+}
+
+static inline void decode_bin(struct trace_ref *ref, uint64_t w) {
+	ref->vaddr = w >> 2;
+	ref->type = TRACE_BIN_TYPES[w & 3];
+	ref->size = 0;
+}
+
+// Decodes up to max references of a binary trace.
+static int read_batch_bin(struct trace_reader *tr, struct trace_ref *refs, int max) {
+	int i, n;
+
+	if (tr->map != NULL) {
+		n = tr->end > tr->pos ? (tr->end - tr->pos) / sizeof(uint64_t) : 0;
+		n = n < max ? n : max;
+		for (i = 0; i < n; i++) {
+			uint64_t w;
+
+			memcpy(&w, tr->pos + i * sizeof(uint64_t), sizeof(w));
+			decode_bin(&refs[i], w);
+		}
+		tr->pos += n * sizeof(uint64_t);
+	} else {
+		uint64_t w[REPLAY_BATCH];
+
+		n = fread(w, sizeof(uint64_t), max < REPLAY_BATCH ? max : REPLAY_BATCH, tr->fp);
+		for (i = 0; i < n; i++) {
+			decode_bin(&refs[i], w[i]);
+		}
+	}
+	return n;
+}
+
+/* Decodes up to max references from lackey output.  A line can complete a
+ * whole Fastslim fill, so references are handed out of the lackey reader
+ * until it runs dry before the next line is read.
+ */
+static int read_batch_lackey(struct trace_reader *tr, struct trace_ref *refs, int max) {
+	char buf[MAXLINE];
+	int n = lackey_drain(tr->lk, refs, max);
+
+	while (n < max) {
+		const char *s, *e;
+
+		if (tr->map != NULL) {
+			if (tr->pos >= tr->end) {
+				break;
+			}
+			s = tr->pos;
+			e = next_newline(tr, s);
+			tr->pos = e < tr->end ? e + 1 : e;
+		} else {
+			if (fgets(buf, MAXLINE, tr->fp) == NULL) {
+				break;
+			}
+			s = buf;
+			e = buf + strcspn(buf, "\n");
+		}
+		lackey_line(tr->lk, s, e);
+		n += lackey_drain(tr->lk, refs + n, max - n);
+	}
+	if (n < max) {
+		lackey_finish(tr->lk);
+		n += lackey_drain(tr->lk, refs + n, max - n);
+	}
+	return n;
+}
+
+static int read_batch(struct trace_reader *tr, struct trace_ref *refs, int max) {
+	if (tr->lk != NULL) {
+		return read_batch_lackey(tr, refs, max);
+	}
+	if (tr->binary) {
+		return read_batch_bin(tr, refs, max);
+	}
+	if (tr->map != NULL) {
+		return read_batch_mmap(tr, refs, max);
+	}
+	return read_batch_stdio(tr, refs, max);
+}
+
+/* Maps fp if it is a non-empty regular file and sets up decoding of the
+ * bytes [start, end).  A negative start means the current file position
+ * and a negative end the end of the file.  Returns 0 on success.
+ */
+static int map_trace(struct trace_reader *tr, long start, long end) {
+	struct stat st;
+	void *m;
+
+	if (start < 0) {
+		start = ftell(tr->fp);
+	}
+	if (start < 0 || fstat(fileno(tr->fp), &st) != 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0) {
+		return -1;
+	}
+	if (end < 0 || end > st.st_size) {
+		end = st.st_size;
+	}
+	if (start > end) {
+		start = end;
+	}
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(tr->fp), 0);
+	if (m == MAP_FAILED) {
+		return -1;
+	}
+	madvise(m, st.st_size, MADV_SEQUENTIAL);
+	tr->map = m;
+	tr->map_len = st.st_size;
+	tr->pos = tr->map + start;
+	tr->end = tr->map + end;
+	load_block(tr, tr->pos);
+	return 0;
+}
+
+static void ring_wait(int *spins) {
+	if (++(*spins) > SPIN_LIMIT) {
+		sched_yield();
+	}
+}
+
+/* The parser thread: fills the slot at head and publishes it by advancing
+ * head.  An empty batch marks the end of the trace.
+ */
+static void *parser_main(void *arg) {
+	struct trace_reader *tr = arg;
+	unsigned long head = tr->head;
+	int n;
+
+	do {
+		int spins = 0;
+
+		while (head - __atomic_load_n(&tr->tail, __ATOMIC_ACQUIRE) == RING_SLOTS) {
+			if (__atomic_load_n(&tr->stop, __ATOMIC_RELAXED)) {
+				return NULL;
+			}
+			ring_wait(&spins);
+		}
+		n = read_batch(tr, tr->slots[head % RING_SLOTS], REPLAY_BATCH);
+		tr->count[head % RING_SLOTS] = n;
+		head++;
+		__atomic_store_n(&tr->head, head, __ATOMIC_RELEASE);
+	} while (n > 0 && !__atomic_load_n(&tr->stop, __ATOMIC_RELAXED));
+
+	return NULL;
+}
+
+/* Recognises a binary trace by its magic number and skips past it.  A
+ * stream is peeked at one character, which ungetc() can always push back,
+ * and only read further if that is the magic's first byte.
+ */
+static void detect_binary(struct trace_reader *tr) {
+	char magic[TRACE_BIN_MAGIC_LEN];
+	int c;
+
+	if (tr->map != NULL) {
+		if (tr->map_len >= TRACE_BIN_MAGIC_LEN &&
+		    memcmp(tr->map, TRACE_BIN_MAGIC, TRACE_BIN_MAGIC_LEN) == 0) {
+			tr->binary = 1;
+			if (tr->pos < tr->map + TRACE_BIN_MAGIC_LEN) {
+				tr->pos = tr->map + TRACE_BIN_MAGIC_LEN;
+			}
+		}
+		return;
+	}
+	if ((c = getc(tr->fp)) == EOF) {
+		return;
+	}
+	ungetc(c, tr->fp);
+	if (c != TRACE_BIN_MAGIC[0]) {
+		return;
+	}
+	if (fread(magic, 1, sizeof(magic), tr->fp) != sizeof(magic) ||
+	    memcmp(magic, TRACE_BIN_MAGIC, sizeof(magic)) != 0) {
+		fprintf(stderr, "Error: tracefile is neither a text nor a binary trace\n");
+		exit(1);
+	}
+	tr->binary = 1;
+}
+
+static struct trace_reader *open_reader(FILE *fp, long start, long end,
+				       int flags) {
+	struct trace_reader *tr = calloc(1, sizeof(struct trace_reader));
+	int threaded = (flags & TRACE_THREADED) != 0;
+
+	if (tr == NULL) {
+		perror("Failed to allocate trace reader");
+		exit(1);
+	}
+	tr->fp = fp;
+	tr->threaded = threaded;
+	if (!(flags & TRACE_STDIO)) {
+		map_trace(tr, start, end);
+	}
+	if (lackey_input) {
+		tr->lk = lackey_open();
+	} else {
+		detect_binary(tr);
+	}
+	tr->slots = malloc((threaded ? RING_SLOTS : 1) * sizeof(*tr->slots));
+	if (tr->slots == NULL) {
+		perror("Failed to allocate trace buffer");
+		exit(1);
+	}
+	return tr;
+}
+
+static void start_parser(struct trace_reader *tr) {
+	if (tr->threaded && pthread_create(&tr->thread, NULL, parser_main, tr) != 0) {
+		fprintf(stderr, "Failed to start trace parser thread\n");
+		exit(1);
+	}
+}
+
+struct trace_reader *trace_open(FILE *fp, int flags) {
+	struct trace_reader *tr = open_reader(fp, -1, -1, flags);
+
+	start_parser(tr);
+	return tr;
+}
+
+/* Opens a reader for the records in bytes [start, end) of fp, which must
+ * start at a line boundary.  Only regular files can be read this way;
+ * returns NULL if fp cannot be mapped.
+ */
+struct trace_reader *trace_open_range(FILE *fp, long start, long end, int flags) {
+	struct trace_reader *tr = open_reader(fp, start, end, flags & ~TRACE_STDIO);
+
+	if (tr->map == NULL) {
+		free(tr->slots);
+		free(tr);
+		return NULL;
+	}
+	start_parser(tr);
+	return tr;
+}
+
+/* Sets *refs to the next batch of decoded references and returns its size,
+ * or 0 at the end of the trace.  The batch stays valid until the next call.
+ */
+int trace_next(struct trace_reader *tr, struct trace_ref **refs) {
+	unsigned slot;
+	int spins = 0;
+	int n;
+
+	if (!tr->threaded) {
+		*refs = tr->slots[0];
+		return read_batch(tr, tr->slots[0], REPLAY_BATCH);
+	}
+
+	// Hand the previous batch back to the parser.
+	if (tr->holding) {
+		__atomic_store_n(&tr->tail, tr->tail + 1, __ATOMIC_RELEASE);
+		tr->holding = 0;
+	}
+	if (tr->done) {
+		return 0;
+	}
+	while (__atomic_load_n(&tr->head, __ATOMIC_ACQUIRE) == tr->tail) {
+		ring_wait(&spins);
+	}
+	slot = tr->tail % RING_SLOTS;
+	n = tr->count[slot];
+	if (n == 0) {
+		tr->done = 1;
+		return 0;
+	}
+	*refs = tr->slots[slot];
+	tr->holding = 1;
+	return n;
+}
+
+void trace_close(struct trace_reader *tr) {
+	if (tr->threaded) {
+		__atomic_store_n(&tr->stop, 1, __ATOMIC_RELAXED);
+		pthread_join(tr->thread, NULL);
+	}
+	if (tr->map != NULL) {
+		munmap((void *)tr->map, tr->map_len);
+	}
+	if (tr->lk != NULL) {
+		lackey_close(tr->lk);
+	}
+	free(tr->slots);
+	free(tr);
+}
@@ -0,0 +1,33 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include "sim.h"
+
+/* Trace readers decode a reference trace into batches of struct trace_ref.
+ * Lines starting with '=' (valgrind markers) are skipped.
+ *
+ * A threaded reader moves decoding onto its own thread, which fills
+ * fixed-size batches in a single-producer/single-consumer ring.  The ring
+ * provides backpressure: the parser waits when every slot is full and the
+ * consumer waits when every slot is empty.  Batches arrive in trace order,
+ * so the decoded references are identical either way.
+ */
+struct trace_reader;
+
+/* A regular file is mapped and decoded in place by a hand-written parser
+ * that indexes newlines 64 bytes at a time with SIMD compares; pipes and
+ * TRACE_STDIO use fgets/sscanf.  Both produce identical records.  Binary
+ * traces (tracefmt.h) are recognised by their magic number and need no
+ * parsing.
+ */
+#define TRACE_THREADED  0x1     // Decode on a separate parser thread
+#define TRACE_STDIO     0x2     // Never map the file
+
+extern struct trace_reader *trace_open(FILE *fp, int flags);
+extern struct trace_reader *trace_open_range(FILE *fp, long start, long end,
+					     int flags);
+extern int trace_next(struct trace_reader *tr, struct trace_ref **refs);
+extern void trace_close(struct trace_reader *tr);
+
+#endif // __TRACE_H__
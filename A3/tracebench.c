@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "sim.h"
+#include "trace.h"
+
+/* Measures how fast a trace can be decoded by each trace reader, and checks
+ * that they decode it identically.
+ * USAGE: tracebench tracefile [rounds]
+ */
+
+struct result {
+	double secs;
+	unsigned long refs;
+	unsigned long hash;
+};
+
+static double now_secs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Decodes the whole trace once.  The hash covers every record in order.
+static struct result decode(char *path, int flags) {
+	struct result r = {0, 0, 0};
+	struct trace_reader *tr;
+	struct trace_ref *refs;
+	FILE *fp;
+	double start;
+	int i, n;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror("Error opening tracefile");
+		exit(1);
+	}
+	start = now_secs();
+	tr = trace_open(fp, flags);
+	while ((n = trace_next(tr, &refs)) > 0) {
+		for (i = 0; i < n; i++) {
+			r.hash = (r.hash * 31 + refs[i].vaddr) * 31 + refs[i].type;
+		}
+		r.refs += n;
+	}
+	trace_close(tr);
+	r.secs = now_secs() - start;
+	fclose(fp);
+	return r;
+}
+
+int main(int argc, char *argv[]) {
+	char *names[] = {"fgets/sscanf", "mmap/simd"};
+	int modes[] = {TRACE_STDIO, 0};
+	struct result best[2];
+	struct stat st;
+	int rounds = 3;
+	int m, i;
+
+	if (argc < 2) {
+		fprintf(stderr, "USAGE: tracebench tracefile [rounds]\n");
+		exit(1);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (stat(argv[1], &st) != 0) {
+		perror("Error opening tracefile");
+		exit(1);
+	}
+
+	for (m = 0; m < 2; m++) {
+		for (i = 0; i < rounds; i++) {
+			struct result r = decode(argv[1], modes[m]);
+			if (i == 0 || r.secs < best[m].secs) {
+				best[m] = r;
+			}
+		}
+		printf("%-14s %10lu refs %8.3f s %8.3f GB/s %8.2f Mrefs/s\n",
+		       names[m], best[m].refs, best[m].secs,
+		       st.st_size / best[m].secs / 1e9,
+		       best[m].refs / best[m].secs / 1e6);
+	}
+	if (best[0].refs != best[1].refs || best[0].hash != best[1].hash) {
+		printf("MISMATCH: decoders disagree\n");
+		return 1;
+	}
+	printf("speedup %.2fx, decoded records identical\n",
+	       best[0].secs / best[1].secs);
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef __TRACEFMT_H__
+#define __TRACEFMT_H__
+
+#include <stdint.h>
+
+/* Binary reference traces, as written by traceprogs/fastslim --binary.
+ *
+ * The file starts with the TRACE_BIN_MAGIC_LEN bytes of TRACE_BIN_MAGIC,
+ * then holds one 64-bit word per reference in native byte order: the
+ * address shifted left by 2, with the index of the reference type in
+ * TRACE_BIN_TYPES in the low 2 bits.  A record decodes with a shift and a
+ * mask, with no text to parse.  The first byte is not printable, so no
+ * text trace starts the same way.
+ */
+#define TRACE_BIN_MAGIC         "\177A3TRACE"
+#define TRACE_BIN_MAGIC_LEN     8
+#define TRACE_BIN_TYPES         "ILSM"
+#define TRACE_BIN_MAX_ADDR      ((uint64_t)1 << 62)
+
+static inline uint64_t trace_bin_encode(uint64_t vaddr, unsigned type_idx) {
+	return (vaddr << 2) | type_idx;
+}
+
+#endif // __TRACEFMT_H__
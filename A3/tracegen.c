@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+/* Generates synthetic reference traces in the .ref format read by sim.
+ *
+ * Distributions over the data pages:
+ *   zipf     page ranks drawn from a Zipf distribution with exponent -z
+ *   uniform  every page equally likely
+ *   scan     a sequential scan that never revisits a page; it ignores -p,
+ *            since every data reference is to a new page, and takes at
+ *            most MAX_PAGES references
+ *   loop     cyclic sequential passes over all the pages
+ *   phase    uniform over a working set of pages/10 that moves to a new
+ *            region every -P references
+ *
+ * A fraction -i of the references are instruction fetches from a small
+ * code region; of the data references a fraction -w are writes (S or M).
+ * The same seed always produces the same trace.
+ */
+
+#define CODE_BASE   0x400000UL
+#define DATA_BASE   0x10000000UL
+#define CODE_PAGES  16
+#define MAX_PAGES   (1UL << 23)   // Keeps addresses within the 36-bit traces
+#define OUTBUF      (1 << 20)
+
+static unsigned long rng_state;
+
+// splitmix64
+static unsigned long rng_next(void) {
+	unsigned long z = (rng_state += 0x9e3779b97f4a7c15UL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+	return z ^ (z >> 31);
+}
+
+// Uniform double in [0, 1).
+static double rng_double(void) {
+	return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Uniform integer in [0, n).
+static unsigned long rng_below(unsigned long n) {
+	return rng_next() % n;
+}
+
+
+/* Zipf sampling by rejection-inversion (Hormann and Derflinger, 1996),
+ * which needs no table, so it works for any number of pages.
+ */
+static double zipf_s;
+static unsigned long zipf_n;
+static double zipf_hx1, zipf_hn, zipf_shelper;
+
+static double helper1(double x) {
+	return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double helper2(double x) {
+	return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+}
+
+static double zipf_h(double x) {
+	return exp(-zipf_s * log(x));
+}
+
+static double zipf_hintegral(double x) {
+	double logx = log(x);
+
+	return helper2((1 - zipf_s) * logx) * logx;
+}
+
+static double zipf_hinverse(double x) {
+	double t = x * (1 - zipf_s);
+
+	if (t < -1) {
+		t = -1;
+	}
+	return exp(helper1(t) * x);
+}
+
+static void zipf_init(unsigned long n, double s) {
+	zipf_n = n;
+	zipf_s = s;
+	zipf_hx1 = zipf_hintegral(1.5) - 1;
+	zipf_hn = zipf_hintegral(n + 0.5);
+	zipf_shelper = 2 - zipf_hinverse(zipf_hintegral(2.5) - zipf_h(2));
+}
+
+// Returns a rank in [0, n), rank 0 being the most popular.
+static unsigned long zipf_next(void) {
+	for (;;) {
+		double u = zipf_hn + rng_double() * (zipf_hx1 - zipf_hn);
+		double x = zipf_hinverse(u);
+		unsigned long k = (unsigned long)(x + 0.5);
+
+		if (k < 1) {
+			k = 1;
+		} else if (k > zipf_n) {
+			k = zipf_n;
+		}
+		if (k - x <= zipf_shelper || u >= zipf_hintegral(k + 0.5) - zipf_h(k)) {
+			return k - 1;
+		}
+	}
+}
+
+
+static char outbuf[OUTBUF];
+static int outlen;
+
+static void emit(char type, unsigned long addr) {
+	char hex[16];
+	int n = 0;
+
+	if (outlen > OUTBUF - 32) {
+		fwrite(outbuf, 1, outlen, stdout);
+		outlen = 0;
+	}
+	do {
+		hex[n++] = "0123456789abcdef"[addr & 0xf];
+		addr >>= 4;
+	} while (addr != 0);
+	outbuf[outlen++] = type;
+	outbuf[outlen++] = ' ';
+	while (n > 0) {
+		outbuf[outlen++] = hex[--n];
+	}
+	outbuf[outlen++] = '\n';
+}
+
+int main(int argc, char *argv[]) {
+	char *usage = "USAGE: tracegen -d zipf|uniform|scan|loop|phase -n refs -p pages\n"
+		"                [-s seed] [-z skew] [-w writefrac] [-i codefrac] [-P phaselen]\n";
+	char *dist = NULL;
+	unsigned long nrefs = 0, pages = 0, seed = 1, phaselen = 100000;
+	double skew = 0.99, wfrac = 0.3, ifrac = 0.1;
+	unsigned long i, ws = 0, ws_base = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:n:p:s:z:w:i:P:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dist = optarg;
+			break;
+		case 'n':
+			nrefs = (unsigned long)strtod(optarg, NULL);
+			break;
+		case 'p':
+			pages = (unsigned long)strtod(optarg, NULL);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'z':
+			skew = strtod(optarg, NULL);
+			break;
+		case 'w':
+			wfrac = strtod(optarg, NULL);
+			break;
+		case 'i':
+			ifrac = strtod(optarg, NULL);
+			break;
+		case 'P':
+			phaselen = (unsigned long)strtod(optarg, NULL);
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			exit(1);
+		}
+	}
+	if (dist == NULL || nrefs == 0 || pages == 0 || phaselen == 0) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	if (pages > MAX_PAGES) {
+		pages = MAX_PAGES;
+	}
+	// Past MAX_PAGES the scan would wrap around and revisit its pages.
+	if (strcmp(dist, "scan") == 0 && nrefs > MAX_PAGES) {
+		fprintf(stderr, "Error: -d scan takes at most %lu references\n", MAX_PAGES);
+		exit(1);
+	}
+	if (strcmp(dist, "zipf") == 0) {
+		zipf_init(pages, skew);
+	} else if (strcmp(dist, "phase") == 0) {
+		ws = pages / 10 ? pages / 10 : 1;
+	} else if (strcmp(dist, "uniform") != 0 && strcmp(dist, "scan") != 0 &&
+		   strcmp(dist, "loop") != 0) {
+		fprintf(stderr, "Error: unknown distribution - %s\n", dist);
+		exit(1);
+	}
+	rng_state = seed;
+
+	for (i = 0; i < nrefs; i++) {
+		unsigned long page;
+		double r = rng_double();
+		char type;
+
+		// Phases count every reference, fetches included.
+		if (dist[0] == 'p' && i % phaselen == 0) {
+			ws_base = rng_below(pages - ws + 1);
+		}
+		if (r < ifrac) {
+			emit('I', CODE_BASE + (rng_below(CODE_PAGES) << 12));
+			continue;
+		}
+		switch (dist[0]) {
+		case 'z':
+			page = zipf_next();
+			break;
+		case 'u':
+			page = rng_below(pages);
+			break;
+		case 's':
+			page = i % MAX_PAGES;
+			break;
+		case 'l':
+			page = i % pages;
+			break;
+		default:  // phase
+			page = ws_base + rng_below(ws);
+			break;
+		}
+		if (rng_double() < wfrac) {
+			type = (rng_next() & 1) ? 'S' : 'M';
+		} else {
+			type = 'L';
+		}
+		emit(type, DATA_BASE + (page << 12));
+	}
+	fwrite(outbuf, 1, outlen, stdout);
+	return 0;
+}
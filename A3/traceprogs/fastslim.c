@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include "../tracefmt.h"
+
+/* Reduces an address trace from the Valgrind lackey tool with the
+ * Fastslim-Demand algorithm (Jin, Sun and Chase, "FastSlim: prefetch-safe
+ * trace reduction for I/O cache simulation", ACM TOMACS 11(2), 2001).
+ *
+ * This is a streaming version of fastslim.py with the same options and
+ * byte-identical output.  Input is read in large blocks and split with
+ * memchr, and the trace buffer is a fixed-size open-addressing table whose
+ * entries are invalidated all at once by bumping a generation number, so a
+ * reference costs O(1) and nothing is ever sorted.
+ *
+ * fastslim.py marks the item it has just built rather than the one already
+ * in its buffer, so repeat references never reach its output: each page is
+ * printed once per buffer fill, with the type of its first reference, in
+ * first-reference order.  A fill is printed only when the next one starts,
+ * so the references of the last, partial fill are dropped.  Both quirks
+ * are kept here, so traces made with either program are the same.
+ */
+
+#define INBUF           (1 << 20)
+#define OUTBUF          (1 << 20)
+#define PAGE_SHIFT      12
+
+// Python's integers are unbounded; 128 bits covers any address a trace
+// will hold.
+typedef __int128 page_t;
+typedef unsigned __int128 uaddr_t;
+
+struct item {
+	page_t pg;
+	char type[2];           // The stripped type field, not NUL terminated
+	unsigned char type_len;
+};
+
+static int keepcode = 0;
+static int binary = 0;
+
+// The current buffer fill, in first-reference order.
+static struct item *items;
+static unsigned nitems, bufsize = 4;
+
+// Set of the pages in items.  A slot is in use only if its generation is
+// the current one.
+static page_t *slot_pg;
+static unsigned *slot_gen;
+static unsigned gen = 1, nslots;
+
+static char outbuf[OUTBUF];
+static size_t outlen;
+
+
+static void flush_out(void) {
+	if (fwrite(outbuf, 1, outlen, stdout) != outlen) {
+		perror("Failed to write trace");
+		exit(1);
+	}
+	outlen = 0;
+}
+
+static void emit(struct item *it) {
+	uaddr_t addr = (uaddr_t)(it->pg < 0 ? -it->pg : it->pg) << PAGE_SHIFT;
+
+	if (outlen > OUTBUF - 32) {
+		flush_out();
+	}
+	if (binary) {
+		const char *t = it->type_len == 1 ? strchr(TRACE_BIN_TYPES, it->type[0]) : NULL;
+		uint64_t w;
+
+		if (t == NULL || it->type[0] == '\0' || it->pg < 0 || addr >= TRACE_BIN_MAX_ADDR) {
+			fprintf(stderr, "Error: reference of type %.*s at page %s%llx cannot be "
+				"stored in a binary trace\n", it->type_len, it->type,
+				it->pg < 0 ? "-" : "", (unsigned long long)(addr >> PAGE_SHIFT));
+			exit(1);
+		}
+		w = trace_bin_encode(addr, t - TRACE_BIN_TYPES);
+		memcpy(outbuf + outlen, &w, sizeof(w));
+		outlen += sizeof(w);
+	} else {
+		char hex[32];
+		int n = 0;
+
+		memcpy(outbuf + outlen, it->type, it->type_len);
+		outlen += it->type_len;
+		outbuf[outlen++] = ' ';
+		if (it->pg < 0) {
+			outbuf[outlen++] = '-';
+		}
+		do {
+			hex[n++] = "0123456789abcdef"[addr & 0xf];
+			addr >>= 4;
+		} while (addr != 0);
+		while (n > 0) {
+			outbuf[outlen++] = hex[--n];
+		}
+		outbuf[outlen++] = '\n';
+	}
+}
+
+// Prints the buffer fill and starts a new one.
+static void emit_buffer(void) {
+	unsigned i;
+
+	for (i = 0; i < nitems; i++) {
+		emit(&items[i]);
+	}
+	nitems = 0;
+	if (++gen == 0) {
+		memset(slot_gen, 0, nslots * sizeof(*slot_gen));
+		gen = 1;
+	}
+}
+
+// Slot holding pg, or the empty slot where it would go.
+static unsigned find_slot(page_t pg) {
+	uint64_t h = (uint64_t)pg ^ (uint64_t)((uaddr_t)pg >> 64);
+	unsigned i = (h * 0x9e3779b97f4a7c15ULL >> 32) & (nslots - 1);
+
+	while (slot_gen[i] == gen && slot_pg[i] != pg) {
+		i = (i + 1) & (nslots - 1);
+	}
+	return i;
+}
+
+static void add_ref(const char *type, size_t type_len, page_t pg) {
+	unsigned i = find_slot(pg);
+
+	if (slot_gen[i] == gen) {
+		return;
+	}
+	if (nitems == bufsize) {
+		emit_buffer();
+		i = find_slot(pg);
+	}
+	slot_gen[i] = gen;
+	slot_pg[i] = pg;
+	items[nitems].pg = pg;
+	memcpy(items[nitems].type, type, type_len);
+	items[nitems].type_len = type_len;
+	nitems++;
+}
+
+
+// Python's str.strip() on [*s, *e).
+static void strip(const char **s, const char **e) {
+	while (*s < *e && ((**s >= '\t' && **s <= '\r') || **s == ' ')) {
+		(*s)++;
+	}
+	while (*e > *s && (((*e)[-1] >= '\t' && (*e)[-1] <= '\r') || (*e)[-1] == ' ')) {
+		(*e)--;
+	}
+}
+
+static int hexval(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+		return (c | 0x20) - 'a' + 10;
+	}
+	return -1;
+}
+
+/* Parses [s, e) as Python's int(s, 16) does and stores the page number,
+ * rounded down, in *pg.  Returns 0 if Python would reject the string, or
+ * (unlike Python) if the address has more than 31 hex digits.
+ */
+static int parse_page(const char *s, const char *e, page_t *pg) {
+	uaddr_t v = 0;
+	int neg = 0, d;
+
+	if (s < e && (*s == '-' || *s == '+')) {
+		neg = (*s++ == '-');
+		strip(&s, &e);
+	}
+	if (e - s > 2 && s[0] == '0' && (s[1] | 0x20) == 'x') {
+		s += 2;
+	}
+	if (s == e) {
+		return 0;
+	}
+	for (; s < e; s++) {
+		if ((d = hexval(*s)) < 0 || v >> 120 != 0) {
+			return 0;
+		}
+		v = (v << 4) | d;
+	}
+	// Python's division rounds towards minus infinity.
+	*pg = neg ? -(page_t)((v + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT)
+		  : (page_t)(v >> PAGE_SHIFT);
+	return 1;
+}
+
+/* One line of lackey output, with its newline if it has one.  The fields
+ * are cut out exactly as fastslim.py cuts them: the type is the first two
+ * characters and the address runs from the fourth to the first comma.
+ */
+static void process_line(const char *line, size_t len) {
+	const char *ts = line, *te = line + (len < 2 ? len : 2);
+	const char *as = line + 3, *ae = memchr(line, ',', len);
+	page_t pg;
+
+	if (line[0] == '=') {
+		return;
+	}
+	strip(&ts, &te);
+	if (!keepcode && te - ts == 1 && ts[0] == 'I') {
+		return;
+	}
+	if (ae == NULL) {
+		ae = line + len;
+	}
+	if (ae <= as) {
+		return;
+	}
+	strip(&as, &ae);
+	if (parse_page(as, ae, &pg)) {
+		add_ref(ts, te - ts, pg);
+	}
+}
+
+static void reduce(int fd) {
+	size_t cap = INBUF, len = 0;
+	char *buf = malloc(cap);
+
+	for (;;) {
+		ssize_t n = read(fd, buf + len, cap - len);
+		char *p = buf, *end, *nl;
+
+		if (n < 0) {
+			perror("Failed to read trace");
+			exit(1);
+		} else if (n == 0) {
+			break;
+		}
+		end = buf + len + n;
+		while ((nl = memchr(p, '\n', end - p)) != NULL) {
+			process_line(p, nl + 1 - p);
+			p = nl + 1;
+		}
+		len = end - p;
+		memmove(buf, p, len);
+		// A line longer than the whole buffer.
+		if (len == cap) {
+			cap *= 2;
+			if ((buf = realloc(buf, cap)) == NULL) {
+				perror("Failed to grow input buffer");
+				exit(1);
+			}
+		}
+	}
+	if (len > 0) {
+		process_line(buf, len);
+	}
+	free(buf);
+}
+
+
+int main(int argc, char *argv[]) {
+	char *usage = "USAGE: fastslim [-k|--keepcode] [-b|--buffersize N] [--binary] [tracefile]\n";
+	static struct option long_opts[] = {
+		{"keepcode", no_argument, NULL, 'k'},
+		{"buffersize", required_argument, NULL, 'b'},
+		{"binary", no_argument, NULL, 'B'},
+		{NULL, 0, NULL, 0}
+	};
+	char *path = "-";
+	int fd = 0, opt;
+	long size;
+
+	while ((opt = getopt_long(argc, argv, "kb:", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'k':
+			keepcode = 1;
+			break;
+		case 'b':
+			size = strtol(optarg, NULL, 10);
+			if (size < 1 || size > (1L << 28)) {
+				fprintf(stderr, "Error: --buffersize must be between 1 and %ld\n", 1L << 28);
+				exit(1);
+			}
+			bufsize = size;
+			break;
+		case 'B':
+			binary = 1;
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			exit(1);
+		}
+	}
+	if (optind < argc) {
+		path = argv[optind++];
+	}
+	if (optind < argc) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	if (strcmp(path, "-") != 0 && (fd = open(path, O_RDONLY)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	// At most half the slots are in use, so probe chains stay short.
+	for (nslots = 16; nslots < 2 * bufsize; nslots *= 2) {
+	}
+	items = malloc(bufsize * sizeof(*items));
+	slot_pg = malloc(nslots * sizeof(*slot_pg));
+	slot_gen = calloc(nslots, sizeof(*slot_gen));
+	if (items == NULL || slot_pg == NULL || slot_gen == NULL) {
+		fprintf(stderr, "Failed to allocate trace buffer\n");
+		exit(1);
+	}
+
+	if (binary) {
+		memcpy(outbuf, TRACE_BIN_MAGIC, TRACE_BIN_MAGIC_LEN);
+		outlen = TRACE_BIN_MAGIC_LEN;
+	}
+	reduce(fd);
+	flush_out();
+	return 0;
+}
@@ -0,0 +1,593 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "../tracefmt.h"
+
+/* Page-granularity trace capture at near-native speed, without valgrind:
+ *
+ *   LD_PRELOAD=./libpagetrace.so ./matmul 1000
+ *
+ * The heap, the stack and large anonymous mappings are protected with
+ * mprotect.  The first access to a protected page faults, the SIGSEGV
+ * handler records it as a reference and opens the page up again: to reads
+ * only after a read fault, so that a later write faults once more and is
+ * recorded as a store.  Every PAGETRACE_PERIOD microseconds of CPU time
+ * the pages are protected again, so the trace holds each page's first
+ * touch and then at most a load and a store per page per period: an
+ * approximate trace, sampled by the period, of the program's data pages.
+ *
+ * The trace is written in the A3 format, text or binary.  A native address
+ * does not fit in the 36-bit space that sim simulates, so each region is
+ * given its own slot of 2^SLOT_SHIFT bytes there: the stack counts down
+ * from the top of its slot, everything else up from the bottom.  The slots
+ * are listed on stderr at exit.  PAGETRACE_RAW keeps native addresses.
+ *
+ * Environment:
+ *   PAGETRACE_FILE     trace to write (default pagetrace.ref)
+ *   PAGETRACE_PERIOD   re-protection period in us of CPU time (default
+ *                      10000); 0 records first touches only
+ *   PAGETRACE_MIN      smallest anonymous mapping to trace, in bytes
+ *                      (default 128 KiB, malloc's mmap threshold)
+ *   PAGETRACE_BINARY   write a binary trace (see tracefmt.h)
+ *   PAGETRACE_RAW      write native addresses
+ *
+ * Limitations: only single-threaded programs can be traced, and only the
+ * process started, not its children.  A system call that reads or writes a
+ * page the program has not touched since it was protected fails with
+ * EFAULT; stdin and stdout are given untraced buffers so that stdio works,
+ * but a program that read()s straight into a heap buffer will see errors.
+ * Pages of a mapping created since the last period are protected only from
+ * the next one, except for memory that malloc returns, whose mapping is
+ * picked up at once.
+ */
+
+#define SLOT_SHIFT      30
+#define MAX_REGIONS     63      // Slots 1..63 fill the 36-bit space
+#define MAX_OWN         8
+#define OUTBUF          (1 << 20)
+#define MAPSBUF         (1 << 16)
+#define ALTSTACK        (1 << 16)
+#define STDIOBUF        (1 << 16)
+#define INIT_SEEN       (1 << 16)
+#define STACK_GROWTH    (64 << 20)
+
+struct region {
+	uintptr_t start, end;
+	unsigned slot, nslots;
+	int stack;
+};
+
+// Memory of our own, in mappings of its own.  These are never traced.
+struct own {
+	uintptr_t start, end;
+};
+
+static struct {
+	int on;
+	int fd;
+	int binary, raw;
+	long page;
+	size_t min_region;
+	long period;
+
+	struct region regions[MAX_REGIONS];
+	int nregions, heap, stack;      // Index of [heap] and [stack], or -1
+	unsigned next_slot;
+	int full_warned;
+
+	struct own own[MAX_OWN];
+	int nown;
+
+	char *out;
+	size_t outlen;
+	char *maps;
+
+	// Set of every page referenced so far, for the first-touch count.
+	uintptr_t *seen;
+	size_t nseen, seen_cap;
+
+	volatile sig_atomic_t busy;     // Set while we touch memory ourselves
+	unsigned long loads, stores, first, ticks, outside;
+} pt;
+
+static struct sigaction old_segv;
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+
+enum scan_mode { SCAN_NEW, SCAN_ALL, SCAN_RELEASE };
+static void scan(enum scan_mode mode);
+
+
+static void die(const char *msg) {
+	size_t n = strlen(msg);
+
+	if (write(2, "pagetrace: ", 11) < 0 || write(2, msg, n) < 0) {
+		_exit(1);
+	}
+	_exit(1);
+}
+
+/* An anonymous mapping with an inaccessible page either side, so that the
+ * kernel never merges it with a mapping of the program's.
+ */
+static void *own_alloc(size_t len) {
+	char *p;
+
+	len = (len + pt.page - 1) & ~(pt.page - 1);
+	p = mmap(NULL, len + 2 * pt.page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED || mprotect(p + pt.page, len, PROT_READ | PROT_WRITE) != 0 ||
+	    pt.nown == MAX_OWN) {
+		die("failed to allocate memory\n");
+	}
+	p += pt.page;
+	pt.own[pt.nown].start = (uintptr_t)p;
+	pt.own[pt.nown].end = (uintptr_t)p + len;
+	pt.nown++;
+	return p;
+}
+
+static void own_free(void *p, size_t len) {
+	int i;
+
+	len = (len + pt.page - 1) & ~(pt.page - 1);
+	for (i = 0; i < pt.nown; i++) {
+		if (pt.own[i].start == (uintptr_t)p) {
+			pt.own[i] = pt.own[--pt.nown];
+			break;
+		}
+	}
+	munmap((char *)p - pt.page, len + 2 * pt.page);
+}
+
+static int is_own(uintptr_t s, uintptr_t e) {
+	int i;
+
+	for (i = 0; i < pt.nown; i++) {
+		if (s < pt.own[i].end + pt.page && e > pt.own[i].start - pt.page) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static void flush_out(void) {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < pt.outlen) {
+		if ((n = write(pt.fd, pt.out + done, pt.outlen - done)) <= 0) {
+			die("failed to write trace\n");
+		}
+		done += n;
+	}
+	pt.outlen = 0;
+}
+
+static int region_of(uintptr_t a) {
+	static int last;
+	int i;
+
+	if (last < pt.nregions && a >= pt.regions[last].start && a < pt.regions[last].end) {
+		return last;
+	}
+	for (i = 0; i < pt.nregions; i++) {
+		if (a >= pt.regions[i].start && a < pt.regions[i].end) {
+			return last = i;
+		}
+	}
+	return -1;
+}
+
+// Address of page a in the compact layout, or 0 if it is beyond its slot.
+static uintptr_t compact(struct region *r, uintptr_t a) {
+	uintptr_t span = (uintptr_t)r->nslots << SLOT_SHIFT;
+	uintptr_t base = (uintptr_t)r->slot << SLOT_SHIFT;
+
+	if (r->stack) {
+		return r->end - a <= span ? base + span - (r->end - a) : 0;
+	}
+	return a - r->start < span ? base + (a - r->start) : 0;
+}
+
+static void seen_grow(void) {
+	uintptr_t *old = pt.seen;
+	size_t old_cap = pt.seen_cap, i, j;
+
+	pt.seen_cap = old_cap ? 2 * old_cap : INIT_SEEN;
+	pt.seen = own_alloc(pt.seen_cap * sizeof(uintptr_t));
+	for (i = 0; i < old_cap; i++) {
+		if (old[i] != 0) {
+			j = (old[i] * 0x9e3779b97f4a7c15UL >> 32) & (pt.seen_cap - 1);
+			while (pt.seen[j] != 0) {
+				j = (j + 1) & (pt.seen_cap - 1);
+			}
+			pt.seen[j] = old[i];
+		}
+	}
+	if (old != NULL) {
+		own_free(old, old_cap * sizeof(uintptr_t));
+	}
+}
+
+// Adds page number pg to the seen set; returns 1 if it was not there.
+static int first_touch(uintptr_t pg) {
+	size_t j;
+
+	if (2 * (pt.nseen + 1) > pt.seen_cap) {
+		seen_grow();
+	}
+	j = (pg * 0x9e3779b97f4a7c15UL >> 32) & (pt.seen_cap - 1);
+	while (pt.seen[j] != 0) {
+		if (pt.seen[j] == pg) {
+			return 0;
+		}
+		j = (j + 1) & (pt.seen_cap - 1);
+	}
+	pt.seen[j] = pg;
+	pt.nseen++;
+	return 1;
+}
+
+static void record(char type, struct region *r, uintptr_t a) {
+	uintptr_t addr = pt.raw ? a : compact(r, a);
+
+	if (addr == 0 || addr >= TRACE_BIN_MAX_ADDR) {
+		pt.outside++;
+		return;
+	}
+	if (first_touch(a / pt.page)) {
+		pt.first++;
+	}
+	if (type == 'S') {
+		pt.stores++;
+	} else {
+		pt.loads++;
+	}
+	if (pt.outlen > OUTBUF - 32) {
+		flush_out();
+	}
+	if (pt.binary) {
+		uint64_t w = trace_bin_encode(addr, strchr(TRACE_BIN_TYPES, type) - TRACE_BIN_TYPES);
+
+		memcpy(pt.out + pt.outlen, &w, sizeof(w));
+		pt.outlen += sizeof(w);
+	} else {
+		char hex[16];
+		int n = 0;
+
+		pt.out[pt.outlen++] = type;
+		pt.out[pt.outlen++] = ' ';
+		do {
+			hex[n++] = "0123456789abcdef"[addr & 0xf];
+			addr >>= 4;
+		} while (addr != 0);
+		while (n > 0) {
+			pt.out[pt.outlen++] = hex[--n];
+		}
+		pt.out[pt.outlen++] = '\n';
+	}
+}
+
+static void on_segv(int sig, siginfo_t *si, void *ctx) {
+	uintptr_t a = (uintptr_t)si->si_addr & ~(pt.page - 1);
+	int r = si->si_code == SEGV_ACCERR ? region_of(a) : -1;
+	int store = 1;
+
+	// The kernel has grown the stack down from a protected page.
+	if (r < 0 && si->si_code == SEGV_ACCERR && pt.stack >= 0 &&
+	    a < pt.regions[pt.stack].start && pt.regions[pt.stack].start - a < STACK_GROWTH) {
+		pt.regions[pt.stack].start = a;
+		r = pt.stack;
+	}
+	if (r < 0) {
+		// Not one of ours: fault again with the program's own handling.
+		sigaction(SIGSEGV, &old_segv, NULL);
+		return;
+	}
+#ifdef REG_ERR
+	store = (((ucontext_t *)ctx)->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+#endif
+	mprotect((void *)a, pt.page, store ? PROT_READ | PROT_WRITE : PROT_READ);
+	if (!pt.busy) {
+		record(store ? 'S' : 'L', &pt.regions[r], a);
+	}
+}
+
+static void on_tick(int sig) {
+	pt.busy = 1;
+	pt.ticks++;
+	scan(SCAN_ALL);
+	pt.busy = 0;
+}
+
+
+static void protect(uintptr_t s, uintptr_t e, int prot) {
+	if (s < e) {
+		mprotect((void *)s, e - s, prot);
+	}
+}
+
+// Starts tracing [s, e), a part of a mapping not yet traced.
+static void add_region(uintptr_t s, uintptr_t e, const char *name) {
+	struct region *r;
+	unsigned n = ((e - s - 1) >> SLOT_SHIFT) + 1;
+	int is_heap = strcmp(name, "[heap]") == 0;
+	int is_stack = strcmp(name, "[stack]") == 0;
+
+	if (is_heap && pt.heap >= 0 && s == pt.regions[pt.heap].end) {
+		pt.regions[pt.heap].end = e;
+		protect(s, e, PROT_NONE);
+		return;
+	}
+	if (is_stack && pt.stack >= 0 && e == pt.regions[pt.stack].start) {
+		pt.regions[pt.stack].start = s;
+		protect(s, e, PROT_NONE);
+		return;
+	}
+	if (!is_heap && !is_stack && e - s < pt.min_region) {
+		return;
+	}
+	if (is_heap) {
+		n = 1;  // 1 GiB of heap; it can grow into the rest of its slot
+	}
+	if (pt.nregions == MAX_REGIONS || pt.next_slot + n > MAX_REGIONS + 1) {
+		if (!pt.full_warned) {
+			pt.full_warned = 1;
+			if (write(2, "pagetrace: out of slots, later mappings are not traced\n", 55) < 0) {
+				return;
+			}
+		}
+		return;
+	}
+	r = &pt.regions[pt.nregions];
+	r->start = s;
+	r->end = e;
+	r->slot = pt.next_slot;
+	r->nslots = n;
+	r->stack = is_stack;
+	pt.next_slot += n;
+	if (is_heap) {
+		pt.heap = pt.nregions;
+	} else if (is_stack) {
+		pt.stack = pt.nregions;
+	}
+	pt.nregions++;
+	protect(s, e, PROT_NONE);
+}
+
+/* One line of /proc/self/maps.  Only private anonymous mappings are
+ * traced; once we have protected part of one, the kernel lists it as
+ * several mappings, some with PROT_READ or PROT_NONE.
+ */
+static void scan_line(char *line, enum scan_mode mode) {
+	uintptr_t s, e, cur, next;
+	char *p = line, *name;
+	int i, f, inode = 0, rw, r;
+
+	s = strtoul(p, &p, 16);
+	e = strtoul(p + 1, &p, 16);
+	rw = p[1] == 'r' && p[2] == 'w' && p[4] == 'p';
+	if (p[4] != 'p') {
+		return;
+	}
+	// Skip perms, offset and device to the inode.
+	for (f = 0; f < 3; f++) {
+		while (*p == ' ') {
+			p++;
+		}
+		while (*p != ' ' && *p != '\0') {
+			p++;
+		}
+	}
+	inode = strtoul(p, &p, 10) != 0;
+	while (*p == ' ') {
+		p++;
+	}
+	name = p;
+	if (inode || (*name != '\0' && strcmp(name, "[heap]") != 0 &&
+		      strcmp(name, "[stack]") != 0) || is_own(s, e)) {
+		return;
+	}
+
+	for (cur = s; cur < e; cur = next) {
+		if ((r = region_of(cur)) >= 0) {
+			next = pt.regions[r].end < e ? pt.regions[r].end : e;
+			if (mode == SCAN_ALL) {
+				protect(cur, next, PROT_NONE);
+			} else if (mode == SCAN_RELEASE) {
+				protect(cur, next, PROT_READ | PROT_WRITE);
+			}
+			continue;
+		}
+		next = e;
+		for (i = 0; i < pt.nregions; i++) {
+			if (pt.regions[i].start > cur && pt.regions[i].start < next) {
+				next = pt.regions[i].start;
+			}
+		}
+		if (rw && mode != SCAN_RELEASE) {
+			add_region(cur, next, name);
+		}
+	}
+}
+
+static void scan(enum scan_mode mode) {
+	int fd = open("/proc/self/maps", O_RDONLY);
+	size_t len = 0;
+	ssize_t n;
+	char *nl, *p;
+
+	if (fd < 0) {
+		die("cannot open /proc/self/maps\n");
+	}
+	while ((n = read(fd, pt.maps + len, MAPSBUF - 1 - len)) > 0) {
+		len += n;
+		pt.maps[len] = '\0';
+		for (p = pt.maps; (nl = strchr(p, '\n')) != NULL; p = nl + 1) {
+			*nl = '\0';
+			scan_line(p, mode);
+		}
+		len -= p - pt.maps;
+		memmove(pt.maps, p, len);
+	}
+	close(fd);
+}
+
+/* Picks up the mapping of memory that malloc has just returned, if it is
+ * one we do not trace yet, without waiting for the next period.
+ */
+static void *watch(void *p) {
+	sigset_t set, old;
+
+	if (p != NULL && pt.on && region_of((uintptr_t)p) < 0) {
+		sigemptyset(&set);
+		sigaddset(&set, SIGVTALRM);
+		sigprocmask(SIG_BLOCK, &set, &old);
+		pt.busy = 1;
+		scan(SCAN_NEW);
+		pt.busy = 0;
+		sigprocmask(SIG_SETMASK, &old, NULL);
+	}
+	return p;
+}
+
+void *malloc(size_t n) {
+	return watch(__libc_malloc(n));
+}
+
+void *calloc(size_t n, size_t size) {
+	return watch(__libc_calloc(n, size));
+}
+
+void *realloc(void *p, size_t n) {
+	return watch(__libc_realloc(p, n));
+}
+
+void *memalign(size_t align, size_t n) {
+	return watch(__libc_memalign(align, n));
+}
+
+int posix_memalign(void **p, size_t align, size_t n) {
+	if ((*p = memalign(align, n)) == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+void *aligned_alloc(size_t align, size_t n) {
+	return memalign(align, n);
+}
+
+
+static long env_long(const char *name, long def) {
+	char *s = getenv(name);
+
+	return s != NULL && *s != '\0' ? strtol(s, NULL, 0) : def;
+}
+
+__attribute__((constructor))
+static void pagetrace_start(void) {
+	const char *path = getenv("PAGETRACE_FILE");
+	struct sigaction sa;
+	struct itimerval it;
+	stack_t ss;
+
+	// Children would write over the same trace.
+	unsetenv("LD_PRELOAD");
+
+	pt.page = sysconf(_SC_PAGESIZE);
+	pt.period = env_long("PAGETRACE_PERIOD", 10000);
+	pt.min_region = env_long("PAGETRACE_MIN", 128 << 10);
+	pt.binary = env_long("PAGETRACE_BINARY", 0) != 0;
+	pt.raw = env_long("PAGETRACE_RAW", 0) != 0;
+	pt.heap = pt.stack = -1;
+	pt.next_slot = 1;
+	if (path == NULL || *path == '\0') {
+		path = "pagetrace.ref";
+	}
+	if ((pt.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	pt.out = own_alloc(OUTBUF);
+	pt.maps = own_alloc(MAPSBUF);
+	seen_grow();
+	setvbuf(stdin, own_alloc(STDIOBUF), _IOFBF, STDIOBUF);
+	setvbuf(stdout, own_alloc(STDIOBUF), isatty(1) ? _IOLBF : _IOFBF, STDIOBUF);
+	if (pt.binary) {
+		memcpy(pt.out, TRACE_BIN_MAGIC, TRACE_BIN_MAGIC_LEN);
+		pt.outlen = TRACE_BIN_MAGIC_LEN;
+	}
+
+	// The handler cannot run on the stack it is tracing.
+	ss.ss_sp = own_alloc(ALTSTACK);
+	ss.ss_size = ALTSTACK;
+	ss.ss_flags = 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = on_segv;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+	sigaddset(&sa.sa_mask, SIGVTALRM);
+	if (sigaltstack(&ss, NULL) != 0 || sigaction(SIGSEGV, &sa, &old_segv) != 0) {
+		die("cannot install the fault handler\n");
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_tick;
+	sa.sa_flags = SA_ONSTACK | SA_RESTART;
+	sigaction(SIGVTALRM, &sa, NULL);
+
+	pt.on = 1;
+	scan(SCAN_NEW);
+	if (pt.period > 0) {
+		it.it_interval.tv_sec = it.it_value.tv_sec = pt.period / 1000000;
+		it.it_interval.tv_usec = it.it_value.tv_usec = pt.period % 1000000;
+		setitimer(ITIMER_VIRTUAL, &it, NULL);
+	}
+}
+
+__attribute__((destructor))
+static void pagetrace_stop(void) {
+	struct itimerval it;
+	int i;
+
+	if (!pt.on) {
+		return;
+	}
+	memset(&it, 0, sizeof(it));
+	setitimer(ITIMER_VIRTUAL, &it, NULL);
+	pt.busy = 1;
+	scan(SCAN_RELEASE);
+	pt.on = 0;
+	flush_out();
+	close(pt.fd);
+
+	fprintf(stderr, "pagetrace: %lu references (%lu loads, %lu stores), %lu pages, "
+		"%lu periods\n", pt.loads + pt.stores, pt.loads, pt.stores, pt.first, pt.ticks);
+	if (pt.outside > 0) {
+		fprintf(stderr, "pagetrace: %lu references beyond their region's slot dropped\n",
+			pt.outside);
+	}
+	if (!pt.raw) {
+		for (i = 0; i < pt.nregions; i++) {
+			struct region *r = &pt.regions[i];
+
+			fprintf(stderr, "pagetrace: %-7s %lx-%lx at %lx\n",
+				i == pt.heap ? "[heap]" : i == pt.stack ? "[stack]" : "anon",
+				(unsigned long)r->start, (unsigned long)r->end,
+				(unsigned long)r->slot << SLOT_SHIFT);
+		}
+	}
+}
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "sim.h"
+#include "trace.h"
+#include "lackey.h"
+
+/* Characterises a reference trace without simulating it: the reference mix,
+ * the distinct pages, the reuse-distance histogram, the working set over
+ * time and where the references land.  Any trace sim reads is accepted,
+ * through the same trace reader.
+ *
+ * The reuse distance of a reference is the number of distinct other pages
+ * referenced since the previous reference to its page, so LRU with more
+ * frames than that would hit.  Every page's latest reference holds a 1 in
+ * a Fenwick tree indexed by position in the trace, and the distance is the
+ * count of 1s after the previous position, found in O(log n).  Positions
+ * are renumbered when the tree fills, so it stays at a small multiple of
+ * the number of distinct pages however long the trace, and in cache.
+ *
+ * The working set at time t (Denning) is the number of distinct pages
+ * referenced in the last window references, the 1s after position t-window.
+ */
+
+#define MIN_POSITIONS   (1 << 12)
+#define HIST_BUCKETS    65
+#define HEAT_ROWS       64
+#define HEAT_WIDTH      50
+#define NO_PAGE         0xffffffffU
+
+struct page {
+	addr_t pg;
+	unsigned pos;           // Position of its latest reference
+	unsigned long refs, stores;
+};
+
+static struct page *pages;
+static unsigned npages, pages_cap;
+
+// Open-addressing map from page number to index in pages, plus 1.  The
+// page number is kept in the slot so a probe touches only the table.
+struct slot {
+	addr_t pg;
+	unsigned idx;
+};
+static struct slot *slots;
+static unsigned nslots;
+
+// Fenwick tree over positions 1..cap, and what each position holds.
+static unsigned *fenwick;
+static unsigned *pos_page;
+static unsigned long *pos_time;
+static unsigned next_pos, cap;
+
+static unsigned long hist[HIST_BUCKETS];       // Bucket 0: distance 0;
+static unsigned long cold;                     // k: 2^(k-1) .. 2^k - 1
+static unsigned long type_count[4];
+static unsigned long nrefs;
+
+static unsigned long window = 10000, interval = 100000;
+static unsigned long ws_min = ~0UL, ws_max, ws_sum, ws_samples;
+static unsigned top = 20;
+static unsigned page_bits = 12;
+
+
+static double now_secs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xrealloc(void *p, size_t len) {
+	if ((p = realloc(p, len)) == NULL) {
+		perror("Failed to allocate trace statistics");
+		exit(1);
+	}
+	return p;
+}
+
+static unsigned hash_slot(addr_t pg) {
+	return (pg * 0x9e3779b97f4a7c15UL >> 32) & (nslots - 1);
+}
+
+static void grow_slots(void) {
+	unsigned i, j;
+
+	nslots = nslots ? 2 * nslots : 1 << 12;
+	slots = xrealloc(slots, nslots * sizeof(struct slot));
+	memset(slots, 0, nslots * sizeof(struct slot));
+	for (i = 0; i < npages; i++) {
+		for (j = hash_slot(pages[i].pg); slots[j].idx != 0; j = (j + 1) & (nslots - 1)) {
+		}
+		slots[j].pg = pages[i].pg;
+		slots[j].idx = i + 1;
+	}
+}
+
+// The page record for pg, added with pos NO_PAGE if it is new.
+static struct page *lookup(addr_t pg) {
+	unsigned j;
+
+	for (j = hash_slot(pg); slots[j].idx != 0; j = (j + 1) & (nslots - 1)) {
+		if (slots[j].pg == pg) {
+			return &pages[slots[j].idx - 1];
+		}
+	}
+	if (npages == pages_cap) {
+		pages_cap = pages_cap ? 2 * pages_cap : 1 << 16;
+		pages = xrealloc(pages, pages_cap * sizeof(struct page));
+	}
+	pages[npages].pg = pg;
+	pages[npages].pos = NO_PAGE;
+	pages[npages].refs = pages[npages].stores = 0;
+	slots[j].pg = pg;
+	slots[j].idx = ++npages;
+	if (2 * npages > nslots) {
+		grow_slots();
+	}
+	return &pages[npages - 1];
+}
+
+
+// Locals, since stores to the tree could otherwise alias cap.
+static void fenwick_add(unsigned pos, int v) {
+	unsigned *f = fenwick, n = cap;
+
+	for (pos++; pos <= n; pos += pos & -pos) {
+		f[pos] += v;
+	}
+}
+
+// Number of 1s at positions 0..pos-1.
+static unsigned fenwick_prefix(unsigned pos) {
+	unsigned *f = fenwick, s = 0;
+
+	for (; pos > 0; pos -= pos & -pos) {
+		s += f[pos];
+	}
+	return s;
+}
+
+/* Moves the latest references down to positions 0..npages-1, in order,
+ * and rebuilds the tree, growing it if more than a quarter is in use so
+ * that renumbering stays rare.
+ */
+static void renumber(void) {
+	unsigned i, j, n = 0;
+
+	for (i = 0; i < next_pos; i++) {
+		if (pos_page[i] != NO_PAGE) {
+			pos_page[n] = pos_page[i];
+			pos_time[n] = pos_time[i];
+			pages[pos_page[n]].pos = n;
+			n++;
+		}
+	}
+	next_pos = n;
+	if (cap < MIN_POSITIONS || n > cap / 4) {
+		cap = cap < MIN_POSITIONS ? MIN_POSITIONS : 2 * cap;
+		fenwick = xrealloc(fenwick, (cap + 1) * sizeof(unsigned));
+		pos_page = xrealloc(pos_page, cap * sizeof(unsigned));
+		pos_time = xrealloc(pos_time, cap * sizeof(unsigned long));
+	}
+	memset(fenwick, 0, (cap + 1) * sizeof(unsigned));
+	for (i = 1; i <= n; i++) {
+		fenwick[i]++;
+		if ((j = i + (i & -i)) <= cap) {
+			fenwick[j] += fenwick[i];
+		}
+	}
+	for (; i <= cap; i++) {
+		if ((j = i + (i & -i)) <= cap) {
+			fenwick[j] += fenwick[i];
+		}
+	}
+}
+
+static int log2_bucket(unsigned long d) {
+	return d == 0 ? 0 : 64 - __builtin_clzl(d);
+}
+
+// Distinct pages referenced in the last window references.
+static unsigned long working_set(void) {
+	unsigned lo = 0, hi = next_pos, mid;
+
+	if (nrefs <= window) {
+		return npages;
+	}
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (pos_time[mid] <= nrefs - window) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return npages - fenwick_prefix(lo);
+}
+
+static void sample_working_set(void) {
+	unsigned long ws = working_set();
+
+	printf("%12lu %10lu\n", nrefs, ws);
+	ws_min = ws < ws_min ? ws : ws_min;
+	ws_max = ws > ws_max ? ws : ws_max;
+	ws_sum += ws;
+	ws_samples++;
+}
+
+static void reference(struct trace_ref *r) {
+	static unsigned last = NO_PAGE;
+	addr_t pg = r->vaddr >> page_bits;
+	struct page *p;
+
+	nrefs++;
+	switch (r->type) {
+	case 'I': type_count[0]++; break;
+	case 'L': type_count[1]++; break;
+	case 'S': type_count[2]++; break;
+	case 'M': type_count[3]++; break;
+	}
+	if (last != NO_PAGE && pages[last].pg == pg) {
+		// The same page again: distance 0, and it stays where it is.
+		p = &pages[last];
+		pos_time[p->pos] = nrefs;
+		hist[0]++;
+	} else {
+		p = lookup(pg);
+		if (next_pos == cap) {
+			renumber();
+		}
+		if (p->pos == NO_PAGE) {
+			cold++;
+		} else {
+			hist[log2_bucket(npages - fenwick_prefix(p->pos + 1))]++;
+			fenwick_add(p->pos, -1);
+			pos_page[p->pos] = NO_PAGE;
+		}
+		p->pos = next_pos++;
+		pos_page[p->pos] = p - pages;
+		pos_time[p->pos] = nrefs;
+		fenwick_add(p->pos, 1);
+		last = p - pages;
+	}
+	p->refs++;
+	if (r->type == 'S' || r->type == 'M') {
+		p->stores++;
+	}
+	if (nrefs % interval == 0) {
+		sample_working_set();
+	}
+}
+
+
+static int by_refs(const void *a, const void *b) {
+	const struct page *x = a, *y = b;
+
+	return x->refs < y->refs ? 1 : x->refs > y->refs ? -1 : (x->pg > y->pg) - (x->pg < y->pg);
+}
+
+static int by_page(const void *a, const void *b) {
+	const struct page *x = a, *y = b;
+
+	return (x->pg > y->pg) - (x->pg < y->pg);
+}
+
+static double pct(unsigned long n, unsigned long of) {
+	return of ? 100.0 * n / of : 0;
+}
+
+static void report_mix(void) {
+	int i;
+
+	printf("\nReferences: %lu, distinct pages: %u (%.1f MiB)\n", nrefs, npages,
+	       (double)npages * (1UL << page_bits) / (1 << 20));
+	printf("Mix:");
+	for (i = 0; i < 4; i++) {
+		printf("  %c %lu (%.1f%%)", "ILSM"[i], type_count[i], pct(type_count[i], nrefs));
+	}
+	printf("\n");
+}
+
+/* The reuse-distance histogram in powers of two.  A reference with
+ * distance d hits in LRU with more than d frames, so the running total is
+ * LRU's hit rate with the bucket's frames.
+ */
+static void report_reuse(void) {
+	unsigned long sum = 0;
+	int k, last = 0;
+
+	for (k = 0; k < HIST_BUCKETS; k++) {
+		if (hist[k] != 0) {
+			last = k;
+		}
+	}
+	printf("\nReuse distance (distinct pages between references to a page):\n");
+	printf("%21s %12s %7s %10s %10s\n", "distance", "refs", "%", "frames", "LRU hit %");
+	for (k = 0; k <= last; k++) {
+		unsigned long lo = k ? 1UL << (k - 1) : 0, hi = k ? (1UL << k) - 1 : 0;
+		char range[32];
+
+		sum += hist[k];
+		snprintf(range, sizeof(range), lo == hi ? "%lu" : "%lu-%lu", lo, hi);
+		printf("%21s %12lu %7.2f %10lu %10.2f\n", range, hist[k], pct(hist[k], nrefs),
+		       hi + 1, pct(sum, nrefs));
+	}
+	printf("%21s %12lu %7.2f\n", "cold", cold, pct(cold, nrefs));
+}
+
+static void report_working_set(void) {
+	if (ws_samples == 0) {
+		return;
+	}
+	printf("Working set over %lu references: min %lu, mean %.1f, max %lu pages\n",
+	       window, ws_min, (double)ws_sum / ws_samples, ws_max);
+}
+
+/* The top pages by references, then a heat map of the references by
+ * address: runs of consecutive pages, doubled until the map fits in
+ * HEAT_ROWS rows.  Sorts pages, so it comes last.
+ */
+static void report_heat(void) {
+	unsigned long max = 0, sum;
+	unsigned i, j, rows, shift = 0;
+
+	qsort(pages, npages, sizeof(struct page), by_refs);
+	printf("\nHottest pages:\n");
+	printf("%18s %12s %7s %12s\n", "page", "refs", "%", "stores");
+	for (i = 0; i < top && i < npages; i++) {
+		printf("%18lx %12lu %7.2f %12lu\n", pages[i].pg << page_bits, pages[i].refs,
+		       pct(pages[i].refs, nrefs), pages[i].stores);
+	}
+
+	qsort(pages, npages, sizeof(struct page), by_page);
+	for (;; shift++) {
+		rows = 0;
+		for (i = 0; i < npages; i = j) {
+			for (j = i; j < npages && pages[j].pg >> shift == pages[i].pg >> shift; j++) {
+			}
+			rows++;
+		}
+		if (rows <= HEAT_ROWS) {
+			break;
+		}
+	}
+	for (i = 0; i < npages; i = j) {
+		for (sum = 0, j = i; j < npages && pages[j].pg >> shift == pages[i].pg >> shift; j++) {
+			sum += pages[j].refs;
+		}
+		max = sum > max ? sum : max;
+	}
+	printf("\nHeat map (%lu pages per row):\n", 1UL << shift);
+	for (i = 0; i < npages; i = j) {
+		int bar;
+
+		for (sum = 0, j = i; j < npages && pages[j].pg >> shift == pages[i].pg >> shift; j++) {
+			sum += pages[j].refs;
+		}
+		bar = max ? (sum * HEAT_WIDTH + max - 1) / max : 0;
+		printf("%18lx %12lu %-*.*s\n", pages[i].pg >> shift << shift << page_bits, sum,
+		       HEAT_WIDTH, bar, "##################################################");
+	}
+}
+
+
+int main(int argc, char *argv[]) {
+	char *usage = "USAGE: tracestat [-f tracefile] [--page-size bytes] [--window N]\n"
+		"                 [--interval N] [--top N] [--lackey [--slim N] [--marker file]]\n";
+	static struct option long_opts[] = {
+		{"page-size", required_argument, NULL, 'p'},
+		{"window", required_argument, NULL, 'w'},
+		{"interval", required_argument, NULL, 'i'},
+		{"top", required_argument, NULL, 't'},
+		{"lackey", no_argument, NULL, 'L'},
+		{"slim", required_argument, NULL, 'S'},
+		{"marker", required_argument, NULL, 'M'},
+		{NULL, 0, NULL, 0}
+	};
+	char *tracefile = NULL;
+	FILE *fp = stdin;
+	struct trace_reader *tr;
+	struct trace_ref *refs;
+	unsigned long size;
+	double start;
+	int opt, i, n;
+
+	while ((opt = getopt_long(argc, argv, "f:", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'f':
+			tracefile = optarg;
+			break;
+		case 'p':
+			size = strtoul(optarg, NULL, 0);
+			for (page_bits = 0; page_bits < 31 && (1UL << page_bits) < size; page_bits++) {
+			}
+			if (size != 1UL << page_bits) {
+				fprintf(stderr, "Error: --page-size must be a power of 2\n");
+				exit(1);
+			}
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			interval = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			top = strtoul(optarg, NULL, 10);
+			break;
+		case 'L':
+			lackey_input = 1;
+			break;
+		case 'S':
+			lackey_slim = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			lackey_read_marker(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			exit(1);
+		}
+	}
+	if (optind < argc || window == 0 || interval == 0) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	if ((lackey_slim != 8 || marker_start != 0) && !lackey_input) {
+		fprintf(stderr, "Error: --slim and --marker need --lackey\n");
+		exit(1);
+	}
+	if (tracefile != NULL && (fp = fopen(tracefile, "r")) == NULL) {
+		perror("Error opening tracefile");
+		exit(1);
+	}
+
+	grow_slots();
+	renumber();
+	start = now_secs();
+	printf("Working set (pages referenced in the last %lu references):\n", window);
+	printf("%12s %10s\n", "refs", "pages");
+	tr = trace_open(fp, 0);
+	while ((n = trace_next(tr, &refs)) > 0) {
+		for (i = 0; i < n; i++) {
+			reference(&refs[i]);
+		}
+	}
+	trace_close(tr);
+	if (nrefs % interval != 0 && nrefs > 0) {
+		sample_working_set();
+	}
+	report_working_set();
+	report_mix();
+	report_reuse();
+	if (lackey_input) {
+		lackey_report();
+	}
+	fprintf(stderr, "Analysed %lu references in %.3f s (%.1f M/s)\n", nrefs,
+		now_secs() - start, nrefs / (now_secs() - start) / 1e6);
+	report_heat();
+	return 0;
+}
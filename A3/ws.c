@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pagetable.h"
+#include "replay.h"
+#include "arena.h"
+#include "checkpoint.h"
+
+/* Variable-allocation policies.  Instead of always filling all memsize
+ * frames, the resident set grows and shrinks with the trace's locality,
+ * and frames a page no longer needs go back to the free pool.  memsize is
+ * only a cap; when it is reached the policy evicts like a fixed one.
+ *
+ * ws   Denning's working set: a page stays resident while it has been
+ *      referenced within the last window references (tau).
+ * pff  Page-fault frequency: on a fault, if more than window references
+ *      have passed since the previous fault, the pages not referenced in
+ *      between are released; otherwise the resident set just grows.
+ *
+ * Both report the average and peak resident set, so the memory a trace
+ * actually needs for a given fault rate can be read from a single run.
+ */
+
+extern struct coremap coremap;
+
+static unsigned long window;
+
+static double resident_sum;
+static int resident_peak;
+static int released;
+
+// Accumulates the resident set once per reference.
+static inline void account(void) {
+    resident_sum += resident_count;
+    if (resident_count > resident_peak) {
+        resident_peak = resident_count;
+    }
+}
+
+static void account_init(unsigned long default_window) {
+    window = ws_window ? ws_window : default_window;
+    resident_sum = 0;
+    resident_peak = 0;
+    released = 0;
+}
+
+static void account_save(FILE *fp) {
+    CKPT_WRITE(fp, resident_sum);
+    CKPT_WRITE(fp, resident_peak);
+    CKPT_WRITE(fp, released);
+}
+
+static void account_restore(FILE *fp) {
+    CKPT_READ(fp, resident_sum);
+    CKPT_READ(fp, resident_peak);
+    CKPT_READ(fp, released);
+}
+
+static void report(char *name) {
+    printf("\n");
+    printf("%s window: %lu references\n", name, window);
+    printf("Average resident set: %.2f frames\n",
+           ref_count ? resident_sum / ref_count : 0.0);
+    printf("Peak resident set: %d frames\n", resident_peak);
+    printf("Frames released: %d\n", released);
+    printf("Faults per 1000 references: %.4f\n",
+           ref_count ? (double)miss_count / ref_count * 1000 : 0.0);
+}
+
+
+//---------------------------------------------------------------------
+// Working set.  Resident frames are kept on a list ordered by last
+// reference, most recent first, so the pages that left the window are
+// always at the tail and each reference costs O(1) amortised.
+
+static int *ws_prev, *ws_next;
+static int *last_ref;           // ref_count at the frame's last reference
+static unsigned char *listed;
+static int head, tail;
+
+static void ws_unlink(int frame) {
+    if (ws_prev[frame] != -1) {
+        ws_next[ws_prev[frame]] = ws_next[frame];
+    } else {
+        head = ws_next[frame];
+    }
+    if (ws_next[frame] != -1) {
+        ws_prev[ws_next[frame]] = ws_prev[frame];
+    } else {
+        tail = ws_prev[frame];
+    }
+    listed[frame] = 0;
+}
+
+static void ws_push(int frame) {
+    ws_prev[frame] = -1;
+    ws_next[frame] = head;
+    if (head != -1) {
+        ws_prev[head] = frame;
+    } else {
+        tail = frame;
+    }
+    head = frame;
+    listed[frame] = 1;
+}
+
+/* Memory is at the cap: evict the page referenced least recently.
+ */
+int ws_evict() {
+    int frame = tail;
+
+    ws_unlink(frame);
+    return frame;
+}
+
+/* Moves the frame to the head of the list, then releases every page whose
+ * last reference has fallen out of the window.
+ */
+void ws_ref(pgtbl_entry_t *p) {
+    int frame = p->frame >> PAGE_SHIFT;
+
+    if (listed[frame]) {
+        ws_unlink(frame);
+    }
+    last_ref[frame] = ref_count;
+    ws_push(frame);
+
+    while ((unsigned long)(ref_count - last_ref[tail]) > window) {
+        int old = tail;
+
+        ws_unlink(old);
+        release_frame(old);
+        released++;
+    }
+    account();
+}
+
+void ws_init() {
+    account_init(10UL * memsize);
+    ws_prev = arena_alloc(&meta_arena, memsize * sizeof(int), 0);
+    ws_next = arena_alloc(&meta_arena, memsize * sizeof(int), 0);
+    last_ref = arena_calloc(&meta_arena, memsize, sizeof(int));
+    listed = arena_calloc(&meta_arena, memsize, sizeof(unsigned char));
+    head = tail = -1;
+}
+
+void ws_save(FILE *fp) {
+    account_save(fp);
+    ckpt_write(fp, ws_prev, memsize * sizeof(int));
+    ckpt_write(fp, ws_next, memsize * sizeof(int));
+    ckpt_write(fp, last_ref, memsize * sizeof(int));
+    ckpt_write(fp, listed, memsize);
+    CKPT_WRITE(fp, head);
+    CKPT_WRITE(fp, tail);
+}
+
+/* Coming from another algorithm, every resident page starts out as just
+ * referenced, in frame order.
+ */
+void ws_restore(FILE *fp) {
+    int i;
+
+    if (fp != NULL) {
+        account_restore(fp);
+        ckpt_read(fp, ws_prev, memsize * sizeof(int));
+        ckpt_read(fp, ws_next, memsize * sizeof(int));
+        ckpt_read(fp, last_ref, memsize * sizeof(int));
+        ckpt_read(fp, listed, memsize);
+        CKPT_READ(fp, head);
+        CKPT_READ(fp, tail);
+        return;
+    }
+    for (i = 0; i < memsize; i++) {
+        if (coremap.in_use[i]) {
+            last_ref[i] = ref_count;
+            ws_push(i);
+        }
+    }
+}
+
+void ws_report() {
+    report("Working set");
+}
+
+
+//---------------------------------------------------------------------
+// Page-fault frequency.  A page has been used since the last fault when
+// its last reference is no earlier than that fault, which is a use of the
+// page that faulted, so no use bits need to be cleared on a fault.
+
+static int *last_use;           // ref_count at the frame's last reference
+static int last_fault;          // ref_count at the most recent fault
+static int last_miss;           // miss_count seen by the previous pff_ref
+static int hand;
+
+/* Memory is at the cap: evict the next frame, clock-style, that has not
+ * been used since the last fault, or the one under the hand if every page
+ * has been.
+ */
+int pff_evict() {
+    int i;
+
+    for (i = 0; i < memsize; i++) {
+        int frame = (hand + i) % memsize;
+
+        if (last_use[frame] < last_fault) {
+            hand = (frame + 1) % memsize;
+            return frame;
+        }
+    }
+    i = hand;
+    hand = (hand + 1) % memsize;
+    return i;
+}
+
+void pff_ref(pgtbl_entry_t *p) {
+    int frame = p->frame >> PAGE_SHIFT;
+    int i;
+
+    if (miss_count != last_miss) {
+        // This reference faulted.  A long fault-free stretch means the
+        // resident set is larger than needed: shrink it to the pages used
+        // since the previous fault.
+        last_miss = miss_count;
+        if ((unsigned long)(ref_count - last_fault) > window) {
+            for (i = 0; i < memsize; i++) {
+                if (i != frame && coremap.in_use[i] && last_use[i] < last_fault) {
+                    release_frame(i);
+                    released++;
+                }
+            }
+        }
+        last_fault = ref_count;
+    }
+    last_use[frame] = ref_count;
+    account();
+}
+
+void pff_init() {
+    account_init(memsize);
+    last_use = arena_calloc(&meta_arena, memsize, sizeof(int));
+    last_fault = 0;
+    last_miss = 0;
+    hand = 0;
+}
+
+void pff_save(FILE *fp) {
+    account_save(fp);
+    ckpt_write(fp, last_use, memsize * sizeof(int));
+    CKPT_WRITE(fp, last_fault);
+    CKPT_WRITE(fp, last_miss);
+    CKPT_WRITE(fp, hand);
+}
+
+// Coming from another algorithm, the restore point counts as the last fault.
+void pff_restore(FILE *fp) {
+    if (fp != NULL) {
+        account_restore(fp);
+        ckpt_read(fp, last_use, memsize * sizeof(int));
+        CKPT_READ(fp, last_fault);
+        CKPT_READ(fp, last_miss);
+        CKPT_READ(fp, hand);
+        return;
+    }
+    last_fault = ref_count;
+    last_miss = miss_count;
+}
+
+void pff_report() {
+    report("PFF");
+}
+
+DEFINE_REPLAY(ws)
+DEFINE_REPLAY(pff)
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "cost.h"
+#include "zswap.h"
+#include "checkpoint.h"
+
+unsigned long zswap_size = 0;
+
+// Compression ratio of each page, uniform in [ratio_lo, ratio_hi].
+static double ratio_lo = 3.0, ratio_hi = 3.0;
+
+// PackBits can grow incompressible data by one byte in 128.
+#define ZSWAP_MAX_LEN     (simpagesize + (simpagesize + 127) / 128)
+// Entry numbers are kept in the frame field of the pte.
+#define ZSWAP_MAX_ENTRIES (1U << (32 - PAGE_SHIFT))
+
+struct zentry {
+	pgtbl_entry_t *pte;
+	int prev, next;         // LRU list, or next free entry
+	unsigned len;           // Bytes of data
+	unsigned size;          // Modeled size of the whole page in the pool
+	unsigned char data[];   // ZSWAP_MAX_LEN bytes
+};
+
+// Entries are entry_size bytes apart, as the frame size is set per run.
+#define ENTRY(idx) ((struct zentry *)((char *)entries + (size_t)(idx) * entry_size))
+
+static struct zentry *entries;
+static size_t entry_size;
+static unsigned nentries;       // Entries allocated
+static int free_list;
+static int head, tail;          // Most and least recently stored
+
+static unsigned long pool_used;
+static unsigned long pool_peak;
+static unsigned long stores;
+static unsigned long loads;
+static unsigned long spills;
+static unsigned long bytes_in;  // Uncompressed bytes stored
+static unsigned long bytes_out; // Compressed bytes stored
+
+
+/* PackBits: a control byte c < 128 is followed by c + 1 literal bytes, and
+ * c > 128 by one byte repeated 257 - c times.  It is tiny and fast, and the
+ * zero runs that dominate page data compress well.
+ */
+static int zcompress(const unsigned char *src, int n, unsigned char *dst) {
+	int i = 0, o = 0;
+
+	while (i < n) {
+		int run = 1;
+
+		while (i + run < n && run < 128 && src[i + run] == src[i]) {
+			run++;
+		}
+		if (run >= 2) {
+			dst[o++] = (unsigned char)(257 - run);
+			dst[o++] = src[i];
+			i += run;
+		} else {
+			int len = 1;
+
+			while (i + len < n && len < 128 &&
+			       !(i + len + 1 < n && src[i + len] == src[i + len + 1])) {
+				len++;
+			}
+			dst[o++] = (unsigned char)(len - 1);
+			memcpy(dst + o, src + i, len);
+			o += len;
+			i += len;
+		}
+	}
+	return o;
+}
+
+static void zdecompress(const unsigned char *src, int n, unsigned char *dst) {
+	int i = 0, o = 0;
+
+	while (i < n) {
+		unsigned char c = src[i++];
+
+		if (c < 128) {
+			memcpy(dst + o, src + i, c + 1);
+			o += c + 1;
+			i += c + 1;
+		} else if (c > 128) {
+			memset(dst + o, src[i++], 257 - c);
+			o += 257 - c;
+		}
+	}
+}
+
+
+/* Reads "R" or "LO-HI", compression ratios of at least 1.  Returns 0, or
+ * -1 if the spec is invalid.
+ */
+int zswap_parse_ratio(char *spec) {
+	char *end;
+
+	ratio_lo = ratio_hi = strtod(spec, &end);
+	if (*end == '-') {
+		char *hi = end + 1;
+
+		ratio_hi = strtod(hi, &end);
+		if (end == hi) {
+			return -1;
+		}
+	}
+	return (end == spec || *end != '\0' || ratio_lo < 1.0 ||
+		ratio_hi < ratio_lo) ? -1 : 0;
+}
+
+/* The pool bytes the page at vaddr takes: the page size over its ratio,
+ * which a hash of the page number (splitmix64) places in the range.
+ */
+static unsigned model_size(addr_t vaddr) {
+	unsigned long h = (vaddr >> page_shift) + 0x9e3779b97f4a7c15UL;
+	double ratio;
+
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9UL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebUL;
+	h ^= h >> 31;
+	ratio = ratio_lo + (ratio_hi - ratio_lo) * (double)(h >> 11) / (1UL << 53);
+	return (unsigned)((double)(1UL << page_shift) / ratio + 0.5);
+}
+
+static void lru_unlink(int idx) {
+	struct zentry *e = ENTRY(idx);
+
+	if (e->prev != -1) {
+		ENTRY(e->prev)->next = e->next;
+	} else {
+		head = e->next;
+	}
+	if (e->next != -1) {
+		ENTRY(e->next)->prev = e->prev;
+	} else {
+		tail = e->prev;
+	}
+}
+
+static void entry_free(int idx) {
+	lru_unlink(idx);
+	pool_used -= ENTRY(idx)->size;
+	ENTRY(idx)->next = free_list;
+	free_list = idx;
+}
+
+static int entry_alloc(void) {
+	int idx;
+
+	if (free_list == -1) {
+		unsigned n = nentries ? nentries * 2 : 1024;
+
+		if (n > ZSWAP_MAX_ENTRIES) {
+			n = ZSWAP_MAX_ENTRIES;
+		}
+		if (n == nentries) {
+			return -1;
+		}
+		entries = realloc(entries, n * entry_size);
+		if (entries == NULL) {
+			perror("Failed to grow compressed swap pool");
+			exit(1);
+		}
+		for (idx = n - 1; idx >= (int)nentries; idx--) {
+			ENTRY(idx)->next = free_list;
+			free_list = idx;
+		}
+		nentries = n;
+	}
+	idx = free_list;
+	free_list = ENTRY(idx)->next;
+	return idx;
+}
+
+// Writes the least recently stored page out to the swap file.
+static void spill_oldest(void) {
+	struct zentry *e = ENTRY(tail);
+	pgtbl_entry_t *p = e->pte;
+	char buf[simpagesize];
+
+	zdecompress(e->data, e->len, (unsigned char *)buf);
+	if ((p->swap_off = swap_pageout_data(buf, p->swap_off)) == INVALID_SWAP) {
+		exit(1);
+	}
+	if (cost_enabled) {
+		cost_swap_write();
+	}
+	p->frame &= ~PG_ZSWAP;
+	entry_free(tail);
+	spills++;
+}
+
+
+void zswap_init() {
+	entries = NULL;
+	entry_size = (sizeof(struct zentry) + ZSWAP_MAX_LEN + 7) & ~(size_t)7;
+	nentries = 0;
+	free_list = -1;
+	head = tail = -1;
+	pool_used = pool_peak = 0;
+	stores = loads = spills = 0;
+	bytes_in = bytes_out = 0;
+}
+
+/* Compresses the page in frame into the pool, spilling older pages to make
+ * room, and marks p as held in the pool.  Returns 0 if the page does not
+ * fit even in an empty pool, in which case the caller writes it to swap.
+ */
+int zswap_store(pgtbl_entry_t *p, unsigned frame) {
+	unsigned char buf[ZSWAP_MAX_LEN];
+	char *mem = &physmem[(size_t)frame * simpagesize];
+	unsigned size = model_size(*(addr_t *)(mem + sizeof(int)));
+	int len, idx;
+
+	if (size > zswap_size) {
+		return 0;
+	}
+	len = zcompress((unsigned char *)mem, simpagesize, buf);
+	while (tail != -1 && pool_used + size > zswap_size) {
+		spill_oldest();
+	}
+	while ((idx = entry_alloc()) == -1) {
+		spill_oldest();
+	}
+
+	ENTRY(idx)->pte = p;
+	ENTRY(idx)->len = len;
+	ENTRY(idx)->size = size;
+	memcpy(ENTRY(idx)->data, buf, len);
+	ENTRY(idx)->prev = -1;
+	ENTRY(idx)->next = head;
+	if (head != -1) {
+		ENTRY(head)->prev = idx;
+	} else {
+		tail = idx;
+	}
+	head = idx;
+
+	pool_used += size;
+	if (pool_used > pool_peak) {
+		pool_peak = pool_used;
+	}
+	stores++;
+	bytes_in += 1UL << page_shift;
+	bytes_out += size;
+	if (cost_enabled) {
+		cost_zswap_store();
+	}
+
+	p->frame = ((unsigned)idx << PAGE_SHIFT) | PG_ONSWAP | PG_ZSWAP;
+	return 1;
+}
+
+/* Decompresses p's page from the pool into frame and drops it from the
+ * pool.  The file copy, if any, is stale, so the caller marks p dirty.
+ */
+void zswap_load(pgtbl_entry_t *p, unsigned frame) {
+	int idx = p->frame >> PAGE_SHIFT;
+
+	zdecompress(ENTRY(idx)->data, ENTRY(idx)->len,
+		    (unsigned char *)&physmem[(size_t)frame * simpagesize]);
+	entry_free(idx);
+	loads++;
+	if (cost_enabled) {
+		cost_zswap_load();
+	}
+}
+
+// Points a pooled page's entry back at its pte.
+static void set_entry_pte(pgtbl_entry_t *p) {
+	if ((p->frame & (PG_VALID | PG_ZSWAP)) == PG_ZSWAP) {
+		ENTRY(p->frame >> PAGE_SHIFT)->pte = p;
+	}
+}
+
+/* Checkpoint section: the pool's lists and counters, then the entries as
+ * one block.  Their pte pointers are rebuilt from the restored page tables.
+ */
+void zswap_save(FILE *fp) {
+	CKPT_WRITE(fp, nentries);
+	CKPT_WRITE(fp, free_list);
+	CKPT_WRITE(fp, head);
+	CKPT_WRITE(fp, tail);
+	CKPT_WRITE(fp, pool_used);
+	CKPT_WRITE(fp, pool_peak);
+	CKPT_WRITE(fp, stores);
+	CKPT_WRITE(fp, loads);
+	CKPT_WRITE(fp, spills);
+	CKPT_WRITE(fp, bytes_in);
+	CKPT_WRITE(fp, bytes_out);
+	ckpt_write(fp, entries, nentries * entry_size);
+}
+
+void zswap_restore(FILE *fp) {
+	CKPT_READ(fp, nentries);
+	CKPT_READ(fp, free_list);
+	CKPT_READ(fp, head);
+	CKPT_READ(fp, tail);
+	CKPT_READ(fp, pool_used);
+	CKPT_READ(fp, pool_peak);
+	CKPT_READ(fp, stores);
+	CKPT_READ(fp, loads);
+	CKPT_READ(fp, spills);
+	CKPT_READ(fp, bytes_in);
+	CKPT_READ(fp, bytes_out);
+	if (nentries > 0) {
+		if ((entries = realloc(entries, nentries * entry_size)) == NULL) {
+			perror("Failed to allocate compressed swap pool");
+			exit(1);
+		}
+		ckpt_read(fp, entries, nentries * entry_size);
+		for_each_pte(set_entry_pte);
+	}
+}
+
+void zswap_report() {
+	printf("\n");
+	printf("Zswap pool: %lu bytes, peak use %lu bytes\n", zswap_size, pool_peak);
+	printf("Zswap stores: %lu\n", stores);
+	printf("Zswap loads: %lu\n", loads);
+	printf("Zswap spills to swap: %lu\n", spills);
+	printf("Swap file reads: %lu\n", swap_pageins());
+	// Sizes come from the model, not the frames' filler (see zswap.h).
+	printf("Compression ratio: %.2f (modeled, %.2f-%.2f per page)\n",
+	       bytes_out ? (double)bytes_in / bytes_out : 0.0, ratio_lo, ratio_hi);
+}
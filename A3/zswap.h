@@ -0,0 +1,30 @@
+#ifndef __ZSWAP_H__
+#define __ZSWAP_H__
+
+#include "pagetable.h"
+
+/* A compressed in-memory tier in front of the swap file, like Linux zswap.
+ * Dirty pages evicted from memory are compressed into a pool of zswap_size
+ * bytes instead of being written to swap.  When the pool is full, its least
+ * recently stored pages are decompressed and spilled to the swap file.  A
+ * fault on a page in the pool decompresses it without touching the file.
+ *
+ * A page in the pool has PG_ONSWAP | PG_ZSWAP set and its pool entry number
+ * in place of the frame number.  A frame holds only its page's address, a
+ * version count and zeros, which says nothing about how well the workload's
+ * data compresses.  The frame is still compressed, so loads get the page
+ * back intact, but the size a page takes in the pool comes from a model:
+ * the page size divided by a compression ratio, either fixed or drawn
+ * uniformly from a range (--zswap-ratio R or LO-HI).  A page's ratio is
+ * seeded by its page number, so it is the same every time it is stored and
+ * in every run.  Pool use, and so the spills and loads, follow the model.
+ */
+extern unsigned long zswap_size;        // Pool size in bytes, 0 = disabled
+
+extern int zswap_parse_ratio(char *spec);
+extern void zswap_init(void);
+extern int zswap_store(pgtbl_entry_t *p, unsigned frame);
+extern void zswap_load(pgtbl_entry_t *p, unsigned frame);
+extern void zswap_report(void);
+
+#endif // __ZSWAP_H__